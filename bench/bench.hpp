@@ -0,0 +1,62 @@
+#pragma once
+
+#include "lemlib/vfs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <vector>
+
+/**
+ * @brief Helpers shared by the host benchmarks and tests
+ *
+ * Results are printed as plain text, and a failed check exits with status 1 so `make run` stops on it.
+ */
+
+namespace bench {
+/**
+ * @brief Empty /usd and initialize the VFS on it
+ *
+ */
+inline void freshVFS() {
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator("/usd", error))
+        std::filesystem::remove_all(entry.path(), error);
+    if (error) {
+        std::printf("/usd must exist and be writable\n");
+        std::exit(1);
+    }
+    reloadVFS();
+}
+
+/**
+ * @brief Exit with a message if a condition does not hold
+ *
+ */
+inline void check(bool condition, const char* what) {
+    if (condition) return;
+    std::printf("FAILED: %s\n", what);
+    std::exit(1);
+}
+
+/**
+ * @brief Get the time elapsed since a point, in microseconds
+ *
+ */
+inline double microsecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Get a percentile of samples
+ *
+ * @param samples the samples, which are sorted
+ * @param percentile between 0 and 100
+ */
+inline double percentile(std::vector<double>& samples, double percentile) {
+    std::sort(samples.begin(), samples.end());
+    const size_t index = static_cast<size_t>(percentile / 100 * (samples.size() - 1));
+    return samples[index];
+}
+} // namespace bench
@@ -0,0 +1,58 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       bench_allocator.cpp                                       */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Sector allocation under mixed creates and deletes         */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "bench.hpp"
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+
+using namespace lemlib::fs;
+
+int main() {
+    constexpr size_t CYCLES = 10000;
+    constexpr size_t NAMES = 512;
+    bench::freshVFS();
+    std::mt19937 random(5);
+    // the live files and their sectors
+    std::map<std::string, uint32_t> live;
+    std::vector<double> createTimes;
+    size_t peak = 0;
+    uint32_t highest = 0;
+    for (size_t cycle = 0; cycle < CYCLES; cycle++) {
+        const std::string path = "/logs/run" + std::to_string(random() % NAMES) + ".bin";
+        if (live.count(path) != 0) {
+            deleteFile(path);
+            live.erase(path);
+            continue;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const uint32_t sector = std::stoul(createFile(path));
+        createTimes.push_back(bench::microsecondsSince(start));
+        live[path] = sector;
+        peak = std::max(peak, live.size());
+        highest = std::max(highest, sector);
+        // no two live files ever share a sector
+        if (cycle % 100 == 0) {
+            std::set<uint32_t> sectors;
+            for (const auto& file : live) {
+                bench::check(std::stoul(getFileSector(file.first)) == file.second, "sectors do not move");
+                bench::check(sectors.insert(file.second).second, "no sector is allocated twice");
+            }
+        }
+    }
+    // freed sectors are reused right away, so the sectors never go past the most files alive at once
+    bench::check(highest < peak, "freed sectors are reused");
+    reloadVFS();
+    for (const auto& file : live)
+        bench::check(std::stoul(getFileSector(file.first)) == file.second, "sectors survive a reload");
+    std::printf("%zu cycles, %zu creates, peak %zu live files, highest sector %u\n", CYCLES, createTimes.size(), peak,
+                highest);
+    const double p50 = bench::percentile(createTimes, 50);
+    const double p99 = bench::percentile(createTimes, 99);
+    std::printf("createFile us: p50 %.1f p99 %.1f max %.1f\n", p50, p99, createTimes.back());
+}
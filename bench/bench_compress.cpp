@@ -0,0 +1,113 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       bench_compress.cpp                                        */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Compressed writes against uncompressed writes             */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "bench.hpp"
+#include "vfs_internal.hpp"
+#include <cmath>
+#include <ctime>
+#include <random>
+#include <string>
+
+using namespace lemlib::fs;
+
+/**
+ * @brief Time spent writing or reading a file
+ *
+ * @param wall the elapsed time in seconds
+ * @param cpu the processor time in seconds
+ */
+struct Cost {
+        double wall;
+        double cpu;
+};
+
+/**
+ * @brief Build a match log like the ones the robots write: a CSV line of odometry and motor state every 10 ms
+ *
+ */
+static std::string matchLog(size_t bytes) {
+    std::string log;
+    std::mt19937 random(17);
+    double x = 0, y = 0, theta = 0;
+    char line[128];
+    for (uint32_t time = 0; log.size() < bytes; time += 10) {
+        theta += 0.002 * std::sin(time / 900.0);
+        x += 0.3 * std::cos(theta);
+        y += 0.3 * std::sin(theta);
+        const double voltage = 12.4 - time / 1e6 + (random() % 10) / 100.0;
+        snprintf(line, sizeof(line), "%u,%.3f,%.3f,%.4f,%.2f,%d,%d\n", time, x, y, theta, voltage,
+                 static_cast<int>(random() % 20) + 590, static_cast<int>(random() % 20) + 585);
+        log += line;
+    }
+    return log;
+}
+
+/**
+ * @brief Write data to a new file in chunks the size of a log line
+ *
+ */
+static Cost writeLog(const std::string& path, const std::string& data) {
+    const auto start = std::chrono::steady_clock::now();
+    const std::clock_t cpuStart = std::clock();
+    File file(path, Mode::WRITE);
+    for (size_t offset = 0; offset < data.size(); offset += 64)
+        file.write(data.data() + offset, std::min<size_t>(64, data.size() - offset));
+    file.close();
+    return {bench::microsecondsSince(start) / 1e6, double(std::clock() - cpuStart) / CLOCKS_PER_SEC};
+}
+
+/**
+ * @brief Read a file back and check it holds the data
+ *
+ */
+static Cost readLog(const std::string& path, const std::string& data) {
+    const auto start = std::chrono::steady_clock::now();
+    const std::clock_t cpuStart = std::clock();
+    std::string read(data.size(), '\0');
+    File file(path);
+    bench::check(file.read(read.data(), read.size()) == data.size() && read == data, "the log reads back");
+    return {bench::microsecondsSince(start) / 1e6, double(std::clock() - cpuStart) / CLOCKS_PER_SEC};
+}
+
+int main() {
+    bench::freshVFS();
+    const std::string log = matchLog(8 << 20);
+    const double megabytes = log.size() / 1048576.0;
+
+    setDefaultCompression(false);
+    const Cost plainWrite = writeLog("/plain.csv", log);
+    const Cost plainRead = readLog("/plain.csv", log);
+    setDefaultCompression(true);
+    const Cost compressedWrite = writeLog("/compressed.csv", log);
+    const Cost compressedRead = readLog("/compressed.csv", log);
+    const size_t plainStored = std::filesystem::file_size(getSectorPath(std::stoul(getFileSector("/plain.csv"))));
+    const size_t compressedStored =
+        std::filesystem::file_size(getSectorPath(std::stoul(getFileSector("/compressed.csv"))));
+
+    // the compressor alone, without any I/O
+    std::vector<char> frame(COMPRESSED_FRAME_SIZE);
+    const std::clock_t cpuStart = std::clock();
+    size_t framed = 0;
+    for (size_t offset = 0; offset + COMPRESSED_FRAME_SIZE <= log.size(); offset += COMPRESSED_FRAME_SIZE)
+        framed += compressFrame(log.data() + offset, COMPRESSED_FRAME_SIZE, frame.data()) != 0;
+    const double compressCpu = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    bench::check(framed > 0, "match logs compress");
+
+    // the host disk is much faster than the SD card, so the saving shows in the bytes stored, not the wall time here
+    std::printf("%.1f MiB match log, stored %zu bytes plain and %zu compressed, ratio %.2f\n", megabytes,
+                plainStored, compressedStored, double(plainStored) / compressedStored);
+    std::printf("%-18s %10s %10s %10s\n", "", "wall MiB/s", "cpu MiB/s", "cpu s");
+    std::printf("%-18s %10.1f %10.1f %10.3f\n", "plain write", megabytes / plainWrite.wall,
+                megabytes / plainWrite.cpu, plainWrite.cpu);
+    std::printf("%-18s %10.1f %10.1f %10.3f\n", "compressed write", megabytes / compressedWrite.wall,
+                megabytes / compressedWrite.cpu, compressedWrite.cpu);
+    std::printf("%-18s %10.1f %10.1f %10.3f\n", "plain read", megabytes / plainRead.wall, megabytes / plainRead.cpu,
+                plainRead.cpu);
+    std::printf("%-18s %10.1f %10.1f %10.3f\n", "compressed read", megabytes / compressedRead.wall,
+                megabytes / compressedRead.cpu, compressedRead.cpu);
+    std::printf("compressFrame alone: %.1f MiB/s of cpu\n", megabytes / compressCpu);
+}
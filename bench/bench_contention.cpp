@@ -0,0 +1,103 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       bench_contention.cpp                                      */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Reader tasks looking files up while a writer task runs    */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "bench.hpp"
+#include "pros/rtos.hpp"
+#include <atomic>
+#include <memory>
+#include <string>
+
+using namespace lemlib::fs;
+
+/**
+ * @brief Results of one run
+ *
+ * @param lookups the lookups per second of all the readers together
+ * @param listings the directory listings per second of all the readers together
+ * @param writes the index changes per second of the writer
+ * @param p99 the 99th percentile of the lookup latency in microseconds
+ */
+struct Run {
+        double lookups;
+        double listings;
+        double writes;
+        double p99;
+};
+
+/**
+ * @brief Run reader tasks for a while, with or without a writer task changing the index
+ *
+ * Each reader looks up files that always exist and lists a directory every 64 lookups, so every lookup must succeed
+ * whatever the writer is doing.
+ */
+static Run contend(size_t readers, bool writer) {
+    constexpr uint32_t DURATION = 500;
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> running = 0;
+    std::atomic<size_t> lookups = 0;
+    std::atomic<size_t> listings = 0;
+    std::atomic<size_t> writes = 0;
+    std::atomic<bool> failed = false;
+    std::vector<std::vector<double>> latencies(readers);
+    std::vector<std::unique_ptr<pros::Task>> tasks;
+    for (size_t reader = 0; reader < readers; reader++) {
+        running++;
+        tasks.push_back(std::make_unique<pros::Task>([&, reader] {
+            size_t count = 0;
+            char path[32];
+            while (!stop) {
+                snprintf(path, sizeof(path), "/auton/path%zu.txt", (count * 7 + reader) % 256);
+                const auto start = std::chrono::steady_clock::now();
+                if (!fileExists(path)) failed = true;
+                if (count % 16 == 0) latencies[reader].push_back(bench::microsecondsSince(start));
+                if (count % 64 == 0 && listDirectory("/auton").size() < 256) failed = true;
+                listings += count % 64 == 0;
+                count++;
+            }
+            lookups += count;
+            running--;
+        }));
+    }
+    if (writer) {
+        running++;
+        tasks.push_back(std::make_unique<pros::Task>([&] {
+            size_t count = 0;
+            while (!stop) {
+                const std::string path = "/logs/log" + std::to_string(count % 32) + ".txt";
+                createFile(path);
+                deleteFile(path);
+                count += 2;
+            }
+            writes += count;
+            running--;
+        }));
+    }
+    pros::delay(DURATION);
+    stop = true;
+    while (running != 0) pros::delay(1);
+    bench::check(!failed, "lookups of existing files always succeed");
+    std::vector<double> all;
+    for (const auto& samples : latencies) all.insert(all.end(), samples.begin(), samples.end());
+    const double seconds = DURATION / 1000.0;
+    return {lookups / seconds, listings / seconds, writes / seconds, all.empty() ? 0 : bench::percentile(all, 99)};
+}
+
+int main() {
+    bench::freshVFS();
+    Transaction transaction;
+    for (int i = 0; i < 256; i++) transaction.create("/auton/path" + std::to_string(i) + ".txt");
+    transaction.commit();
+    std::printf("%7s %7s %14s %12s %12s %10s\n", "readers", "writer", "lookups/s", "listings/s", "writes/s",
+                "p99 us");
+    for (size_t readers = 1; readers <= 8; readers *= 2) {
+        for (bool writer : {false, true}) {
+            const Run run = contend(readers, writer);
+            std::printf("%7zu %7s %14.0f %12.0f %12.0f %10.2f\n", readers, writer ? "yes" : "no", run.lookups,
+                        run.listings, run.writes, run.p99);
+        }
+    }
+}
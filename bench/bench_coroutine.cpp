@@ -0,0 +1,66 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       bench_coroutine.cpp                                       */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Cost of creating and running coroutines                   */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "bench.hpp"
+#include "lemlib/vfs_coroutine.hpp"
+#include <atomic>
+
+using namespace lemlib::fs;
+
+static std::atomic<size_t> finished = 0;
+
+/**
+ * @brief A coroutine that yields to the scheduler a few times
+ *
+ * The local buffer makes the frame about as large as the frame of a coroutine streaming a file.
+ */
+static Coroutine yielding(size_t yields) {
+    volatile char buffer[128];
+    for (size_t i = 0; i < yields; i++) {
+        buffer[i % sizeof(buffer)] = static_cast<char>(i);
+        co_await CoroutineScheduler::delay(0);
+    }
+    finished++;
+}
+
+/**
+ * @brief Measure creating and running coroutines with the current frame allocator
+ *
+ */
+static void measure(CoroutineScheduler& scheduler) {
+    constexpr size_t COROUTINES = 100000;
+    // creating and destroying a coroutine without running it is the cost of its frame
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < COROUTINES; i++) Coroutine coroutine = yielding(0);
+    std::printf("  frame allocation and destruction: %.1f ns\n", bench::microsecondsSince(start) * 1000 / COROUTINES);
+
+    for (size_t alive : {1, 16, 256}) {
+        finished = 0;
+        start = std::chrono::steady_clock::now();
+        // keep about `alive` coroutines running, so frames are freed and allocated while others are alive
+        for (size_t spawned = 0; spawned < COROUTINES; spawned++) {
+            while (spawned - finished >= alive) pros::delay(0);
+            scheduler.spawn(yielding(4));
+        }
+        while (scheduler.running() != 0) pros::delay(1);
+        const double runNs = bench::microsecondsSince(start) * 1000 / COROUTINES;
+        bench::check(finished == COROUTINES && scheduler.failures() == 0, "every coroutine finishes");
+        std::printf("  %4zu alive: %.0f ns per coroutine spawned, run through 4 yields and destroyed\n", alive, runNs);
+    }
+}
+
+int main() {
+    // the host heap has per-thread caches that newlib's does not, so only numbers measured on the V5 decide which
+    // allocator is the default
+    CoroutineScheduler scheduler;
+    for (bool pooled : {true, false}) {
+        setCoroutineFramePool(pooled);
+        std::printf("%s frames:\n", pooled ? "pooled" : "heap");
+        measure(scheduler);
+    }
+    setCoroutineFramePool(true);
+}
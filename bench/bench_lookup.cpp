@@ -0,0 +1,58 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       bench_lookup.cpp                                          */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Hash table lookups against the old linear scan            */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "bench.hpp"
+#include <string>
+
+using namespace lemlib::fs;
+
+/**
+ * @brief The index before it was hashed: a vector of entries scanned with std::find_if, comparing full paths
+ *
+ */
+struct LinearEntry {
+        std::string name;
+        std::string sector;
+};
+
+static std::string linearLookup(const std::vector<LinearEntry>& index, std::string_view path) {
+    // the old entry points built the normalized path on every call
+    std::string corrected_path = (path.empty() || path.front() != '/') ? "/" + std::string(path) : std::string(path);
+    const auto it = std::find_if(index.begin(), index.end(),
+                                 [&](const LinearEntry& entry) { return entry.name == corrected_path; });
+    return (it != index.end()) ? it->sector : "";
+}
+
+int main() {
+    constexpr size_t LOOKUPS = 200000;
+    std::printf("%8s %14s %14s\n", "files", "linear ns", "hashed ns");
+    size_t crossover = 0;
+    for (size_t files = 4; files <= 4096; files *= 2) {
+        bench::freshVFS();
+        std::vector<LinearEntry> linear;
+        std::vector<std::string> paths;
+        Transaction transaction;
+        for (size_t i = 0; i < files; i++) {
+            paths.push_back("/auton/paths/path" + std::to_string(i) + ".txt");
+            transaction.create(paths.back());
+            linear.push_back({paths.back(), std::to_string(i)});
+        }
+        transaction.commit();
+        // look up every file in turn, so the average covers every position of the scan
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < LOOKUPS; i++) found += !linearLookup(linear, paths[i % files]).empty();
+        const double linearNs = bench::microsecondsSince(start) * 1000 / LOOKUPS;
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < LOOKUPS; i++) found += fileExists(paths[i % files]);
+        const double hashedNs = bench::microsecondsSince(start) * 1000 / LOOKUPS;
+        bench::check(found == 2 * LOOKUPS, "every file is found");
+        if (crossover == 0 && hashedNs < linearNs) crossover = files;
+        std::printf("%8zu %14.1f %14.1f\n", files, linearNs, hashedNs);
+    }
+    std::printf("hashed lookups are faster from %zu files\n", crossover);
+}
@@ -0,0 +1,140 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       pros_stub.cpp                                             */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Host implementation of the PROS API used by the VFS       */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "pros/apix.h"
+#include "pros/rtos.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief State of a task, which is a detached std::thread on the host
+ *
+ * @param count the notification value of the task
+ */
+struct StubTask {
+        std::mutex mutex;
+        std::condition_variable notified;
+        uint32_t count = 0;
+};
+
+// threads that were not started as a pros::Task get their state when they first ask for it
+static thread_local StubTask* currentTask = nullptr;
+
+/**
+ * @brief Counting semaphore
+ *
+ * @param max the maximum count
+ */
+struct StubSemaphore {
+        std::mutex mutex;
+        std::condition_variable posted;
+        uint32_t count;
+        uint32_t max;
+};
+
+namespace pros {
+namespace c {
+void delay(const uint32_t milliseconds) { std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds)); }
+
+uint32_t millis() {
+    static const auto start = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+task_t task_get_current() {
+    if (currentTask == nullptr) currentTask = new StubTask;
+    return currentTask;
+}
+
+sem_t sem_create(uint32_t max_count, uint32_t init_count) { return new StubSemaphore{{}, {}, init_count, max_count}; }
+
+sem_t sem_binary_create() { return sem_create(1, 0); }
+
+void sem_delete(sem_t sem) { delete static_cast<StubSemaphore*>(sem); }
+
+bool sem_wait(sem_t sem, uint32_t timeout) {
+    StubSemaphore& semaphore = *static_cast<StubSemaphore*>(sem);
+    std::unique_lock<std::mutex> lock(semaphore.mutex);
+    const auto available = [&semaphore] { return semaphore.count > 0; };
+    if (timeout == TIMEOUT_MAX) semaphore.posted.wait(lock, available);
+    else if (!semaphore.posted.wait_for(lock, std::chrono::milliseconds(timeout), available)) return false;
+    semaphore.count--;
+    return true;
+}
+
+bool sem_post(sem_t sem) {
+    StubSemaphore& semaphore = *static_cast<StubSemaphore*>(sem);
+    std::lock_guard<std::mutex> lock(semaphore.mutex);
+    if (semaphore.count == semaphore.max) return false;
+    semaphore.count++;
+    semaphore.posted.notify_one();
+    return true;
+}
+} // namespace c
+
+inline namespace rtos {
+Task::Task(task_fn_t function, void* parameters, std::uint32_t, std::uint16_t, const char*) {
+    StubTask* state = new StubTask;
+    task = state;
+    std::thread([state, function, parameters] {
+        currentTask = state;
+        function(parameters);
+    }).detach();
+}
+
+Task::Task(task_t task)
+    : task(task) {}
+
+void Task::set_priority(std::uint32_t) {}
+
+std::uint32_t Task::notify() {
+    StubTask& state = *static_cast<StubTask*>(task);
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.count++;
+    state.notified.notify_all();
+    return 1;
+}
+
+std::uint32_t Task::notify_take(bool clear_on_exit, std::uint32_t timeout) {
+    StubTask& state = *static_cast<StubTask*>(c::task_get_current());
+    std::unique_lock<std::mutex> lock(state.mutex);
+    const auto notified = [&state] { return state.count > 0; };
+    if (timeout == TIMEOUT_MAX) state.notified.wait(lock, notified);
+    else state.notified.wait_for(lock, std::chrono::milliseconds(timeout), notified);
+    const uint32_t value = state.count;
+    if (clear_on_exit) state.count = 0;
+    else if (value > 0) state.count--;
+    return value;
+}
+
+void Task::delay_until(std::uint32_t* const prev_time, const std::uint32_t delta) {
+    *prev_time += delta;
+    const int32_t remaining = static_cast<int32_t>(*prev_time - c::millis());
+    if (remaining > 0) c::delay(remaining);
+}
+
+Mutex::Mutex()
+    : mutex(new std::mutex, [](void* mutex) { delete static_cast<std::mutex*>(mutex); }) {}
+
+bool Mutex::take() {
+    static_cast<std::mutex*>(mutex.get())->lock();
+    return true;
+}
+
+bool Mutex::give() {
+    static_cast<std::mutex*>(mutex.get())->unlock();
+    return true;
+}
+
+void Mutex::lock() { take(); }
+
+void Mutex::unlock() { give(); }
+} // namespace rtos
+} // namespace pros
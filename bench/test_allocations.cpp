@@ -0,0 +1,49 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       test_allocations.cpp                                      */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Lookups must not allocate                                 */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "bench.hpp"
+#include "vfs_internal.hpp"
+#include <atomic>
+#include <new>
+#include <string>
+
+using namespace lemlib::fs;
+
+// every allocation of the program goes through these
+static std::atomic<size_t> allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* memory = std::malloc(size)) return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+
+int main() {
+    bench::freshVFS();
+    for (int i = 0; i < 300; i++) createFile("/auton/paths/path" + std::to_string(i) + ".txt");
+    bool correct = true;
+    const size_t before = allocations;
+    for (int i = 0; i < 1000; i++) {
+        // with and without the leading slash, found and not found
+        correct &= fileExists("auton/paths/path123.txt");
+        correct &= fileExists("/auton/paths/path7.txt");
+        correct &= !fileExists("/auton/paths/missing.txt");
+        // sector numbers fit in the small string buffer
+        correct &= getFileSector("/auton/paths/path42.txt") == "42";
+        correct &= getFileSector("nowhere").empty();
+        uint32_t sector;
+        correct &= lookupFileSector("auton/paths/path299.txt", sector) && sector == 299;
+    }
+    const size_t lookupAllocations = allocations - before;
+    bench::check(correct, "lookups find the right files");
+    std::printf("allocations during 6000 lookups: %zu\n", lookupAllocations);
+    bench::check(lookupAllocations == 0, "lookups do not allocate");
+}
@@ -1,5 +1,1039 @@
+#pragma once
+
+#include "pros/rtos.h"
+#include "pros/rtos.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Exception class for the VFS
+ *
+ */
+class VFSException : public std::exception {
+    public:
+        /**
+         * @brief Construct a new VFSException
+         *
+         * @param message the message to display when the exception is thrown
+         */
+        VFSException(const std::string& message) : m_message(message) {}
+
+        /**
+         * @brief Get the message of the exception
+         *
+         * @return const char* the message
+         */
+        const char* what() const noexcept override { return m_message.c_str(); }
+    private:
+        std::string m_message;
+};
+
+/**
+ * @brief Initialize the file system
+ *
+ * Once initialized, the VFS can be used from several tasks at once. fileExists() and getFileSector() never wait for
+ * other tasks, listDirectory() runs in parallel with other listings, and changes to the index are serialized. A
+ * lemlib::fs::File must only be used by one task at a time.
+ *
+ * @param cacheSize the RAM budget of the block cache in bytes, 0 to disable it
+ */
+void initVFS(size_t cacheSize = 0);
+
+/**
+ * @brief Discard the resident index and read the index file again
+ *
+ */
+void reloadVFS();
+
+/**
+ * @brief Compact the index journal into the index file
+ *
+ */
+void compactVFS();
+
+/**
+ * @brief Get the sector of a virtual file
+ *
+ * @param path the path of the virtual file
+ * @return std::string the sector the file is stored in, or an empty string if the file is not found
+ */
+std::string getFileSector(std::string_view path);
+
+/**
+ * @brief List all the files and folders in a directory
+ *
+ * @param dir the directory to list
+ * @param recursive whether to list the files in subdirectories as well
+ * @return std::vector<std::string> a vector of all the files and folders in the directory
+ */
+std::vector<std::string> listDirectory(std::string_view dir, bool recursive = false);
+
+/**
+ * @brief Check if a file exists
+ *
+ * @param path path of the file
+ * @return true the file exists
+ * @return false the file does not exist
+ */
+bool fileExists(std::string_view path);
+
+/**
+ * @brief Delete a virtual file
+ *
+ * @param path the path of the virtual file
+ */
+void deleteFile(std::string_view path);
+
+/**
+ * @brief Create a virtual file
+ *
+ * @param path the path of the virtual file
+ * @param overwrite whether to replace a file that already exists at the path
+ * @return std::string the sector the file is stored in
+ */
+std::string createFile(std::string_view path, bool overwrite = true);
+
+/**
+ * @brief Rename a virtual file
+ *
+ * @param oldPath the current path of the virtual file
+ * @param newPath the new path of the virtual file
+ * @param overwrite whether to delete a file that already exists at the new path
+ */
+void renameFile(std::string_view oldPath, std::string_view newPath, bool overwrite = false);
+
 namespace lemlib {
 namespace fs {
+/**
+ * @brief A batch of changes to the index, applied all at once
+ *
+ * Creates, deletes and renames are staged in memory, then commit() checks them, writes them to the index journal
+ * with a single write and flush, and applies them to the resident index. Either every staged change is applied or none
+ * of them are, including after a brown out during the write.
+ */
+class Transaction {
+    public:
+        /**
+         * @brief Stage the creation of a virtual file
+         *
+         * @param path the path of the virtual file
+         * @param overwrite whether to replace a file that already exists at the path
+         * @return Transaction& this transaction
+         */
+        Transaction& create(std::string_view path, bool overwrite = true);
+
+        /**
+         * @brief Stage the deletion of a virtual file
+         *
+         * @param path the path of the virtual file
+         * @return Transaction& this transaction
+         */
+        Transaction& remove(std::string_view path);
+
+        /**
+         * @brief Stage the renaming of a virtual file
+         *
+         * @param oldPath the current path of the virtual file
+         * @param newPath the new path of the virtual file
+         * @param overwrite whether to delete a file that already exists at the new path
+         * @return Transaction& this transaction
+         */
+        Transaction& rename(std::string_view oldPath, std::string_view newPath, bool overwrite = false);
+
+        /**
+         * @brief Apply the staged changes
+         *
+         * Changes are checked in the order they were staged, as if each was applied before the next one. If any of
+         * them fails, an exception is thrown and nothing is changed. The staged changes are cleared either way.
+         * Unlike createFile(), the sector files of new files are not opened, they are created by the first write.
+         * A file created and removed by the same commit is dropped from it, so its sector file is never touched.
+         */
+        void commit();
+
+        /**
+         * @brief Discard the staged changes
+         *
+         */
+        void clear();
+
+        /**
+         * @brief Get the number of staged changes
+         *
+         * @return size_t the number of staged changes
+         */
+        size_t size() const;
+    private:
+        struct Operation {
+                enum Type { CREATE, DELETE, RENAME } type;
+                std::string path;
+                std::string newPath;
+                bool overwrite;
+        };
+
+        std::vector<Operation> m_operations;
+};
+
+/**
+ * @brief Where the data of a virtual file is stored
+ *
+ * SECTOR_FILE stores each file in a file of its own on the SD card. CONTAINER stores files in extents of a few large
+ * preallocated data files (/usd/data0.bin, /usd/data1.bin, ...), which avoids the per-file FAT overhead of opening
+ * many small files and keeps the root of the SD card tidy. Container files still get a sector number, but no sector
+ * file, so use lemlib::fs::File to access them.
+ */
+enum class Storage { SECTOR_FILE, CONTAINER };
+
+/**
+ * @brief Set where files created from now on are stored
+ *
+ * Existing files stay where they are.
+ *
+ * @param storage the storage of new files
+ */
+void setDefaultStorage(Storage storage);
+
+/**
+ * @brief Get where new files are stored
+ *
+ * @return Storage the storage of new files
+ */
+Storage getDefaultStorage();
+
+/**
+ * @brief Set whether files created from now on are compressed
+ *
+ * The contents of a compressed file are compressed in frames of up to 4 KiB as they are written through
+ * lemlib::fs::File, and decompressed transparently when they are read. The flag is recorded in the index with the file.
+ * Compressed files can only be written at their end, so they suit logs, and their size is found by reading the header
+ * of every frame when they are opened. Existing files stay as they are.
+ *
+ * @param enabled whether new files are compressed
+ */
+void setDefaultCompression(bool enabled);
+
+/**
+ * @brief Check if new files are compressed
+ *
+ * @return true new files are compressed
+ * @return false new files are not compressed
+ */
+bool getDefaultCompression();
+
+/**
+ * @brief Set the size up to which files created from now on are stored inside the index
+ *
+ * Inline files are kept in RAM with the index and recorded in its journal, so reading them opens no file and they take
+ * no sector file or FAT entry. Writing one through lemlib::fs::File past the threshold turns it into a sector file
+ * automatically. Like container files, inline files have a sector number but no sector file. Only files that would
+ * be sector files and are not compressed start inline. Existing files stay as they are.
+ *
+ * @param bytes the threshold in bytes, at most 1024, or 0 to store new files in sector files again
+ */
+void setInlineThreshold(size_t bytes);
+
+/**
+ * @brief Get the size up to which new files are stored inside the index
+ *
+ * @return size_t the threshold in bytes, 0 if new files are not stored inline
+ */
+size_t getInlineThreshold();
+
+/**
+ * @brief Reserve space for a virtual file to grow into
+ *
+ * Growing a sector file makes the FAT allocate clusters during the writes, which causes latency spikes in logs. This
+ * grows the sector file to the given size up front instead, and tracks the length of the data in the index, so writes
+ * within the reserved space never allocate. The length is recorded in the journal when the file is flushed or closed,
+ * so data written since then is lost on a brown out, like with container files. Container files get their blocks
+ * allocated, and inline files are moved to their sector file first. The file is created if it does not exist, and
+ * the space is never shrunk. Call it while the file is not open.
+ *
+ * @param path the path of the virtual file
+ * @param bytes the number of bytes to reserve, counting the data of the file
+ */
+void reserve(std::string_view path, size_t bytes);
+
+/**
+ * @brief Ways a virtual file can be opened
+ *
+ * READ opens an existing file for reading. WRITE creates the file if needed and empties it. APPEND creates the file if
+ * needed and makes every write go to its end. READ_WRITE creates the file if needed and keeps its contents.
+ */
+enum class Mode { READ, WRITE, APPEND, READ_WRITE };
+
+/**
+ * @brief What a write does when the write-behind queue is full
+ *
+ * BLOCK waits for the flush task to make room. DROP discards the new data. OVERWRITE_OLDEST discards the oldest queued
+ * data to make room for the new data. Discarded data leaves the bytes it would have written unchanged.
+ */
+enum class Overflow { BLOCK, DROP, OVERWRITE_OLDEST };
+
+/**
+ * @brief Settings of the write-behind queue
+ *
+ */
+struct WriteBehindConfig {
+        // bytes of RAM the queue may use, including 12 bytes of bookkeeping per queued write
+        size_t capacity = 16384;
+        Overflow overflow = Overflow::BLOCK;
+        // priority of the task that writes the queue to the SD card
+        uint32_t priority = TASK_PRIORITY_MIN;
+};
+
+/**
+ * @brief Counters of the write-behind queue
+ *
+ */
+struct WriteBehindStats {
+        // bytes waiting to be written, not including bookkeeping
+        size_t queued;
+        // bytes discarded because the queue was full
+        size_t dropped;
+};
+
+/**
+ * @brief Configure the write-behind queue and start its flush task
+ *
+ * Waits for the queue to be empty before resizing it. The queue is started with the default settings the first time a
+ * file uses write-behind if this was not called before.
+ *
+ * @param config the new settings
+ */
+void configureWriteBehind(const WriteBehindConfig& config = {});
+
+/**
+ * @brief Wait until all queued writes of every file are on the SD card
+ *
+ */
+void flushWriteBehind();
+
+/**
+ * @brief Get the counters of the write-behind queue
+ *
+ * @return WriteBehindStats the counters
+ */
+WriteBehindStats getWriteBehindStats();
+
+/**
+ * @brief Counters of the block cache
+ *
+ */
+struct CacheStats {
+        // blocks of 512 bytes read from the cache
+        size_t hits;
+        // blocks of 512 bytes read from the SD card
+        size_t misses;
+        // the RAM budget of the cache in bytes, rounded down to whole blocks
+        size_t capacity;
+};
+
+/**
+ * @brief Get the counters of the block cache
+ *
+ * The budget of the cache is set by initVFS(). Reads of virtual files go through the cache, and writes update the
+ * blocks already in it.
+ *
+ * @return CacheStats the counters
+ */
+CacheStats getCacheStats();
+
+/**
+ * @brief Reset the hit and miss counters of the block cache
+ *
+ */
+void resetCacheStats();
+
+/**
+ * @brief Read a whole virtual file into an arena owned by the VFS
+ *
+ * The file is read with a single call, straight into the arena. The contents stay in RAM until unload() is called for
+ * the path, and loading the path again reads the file again, invalidating the view returned before.
+ *
+ * @param path the path of the virtual file
+ * @return std::string_view the contents of the file
+ */
+std::string_view load(std::string_view path);
+
+/**
+ * @brief Read a whole virtual file into an arena supplied by the caller
+ *
+ * The file is read with a single call, straight into the arena.
+ *
+ * @param path the path of the virtual file
+ * @param arena where to store the contents of the file
+ * @param capacity the size of the arena in bytes, a larger file throws FILE_TOO_LARGE
+ * @return std::string_view the contents of the file, at the start of the arena
+ */
+std::string_view load(std::string_view path, char* arena, size_t capacity);
+
+/**
+ * @brief Release the arena of a file loaded by load()
+ *
+ * Views of the contents of the file must not be used afterwards. Nothing happens if the file is not loaded.
+ *
+ * @param path the path the file was loaded from
+ */
+void unload(std::string_view path);
+
+struct WriteBehindTarget;
+struct FileStorage;
+struct AsyncRequest;
+class AsyncResult;
+
+/**
+ * @brief Handle to an open virtual file
+ *
+ * The file is looked up in the index once when it is opened, and its sector file stays open until the handle is
+ * closed or destroyed. Reads and writes go through a user space buffer, so small accesses are batched into chunks of
+ * the buffer size. Compressed files always use a buffer of one frame, and writing to them anywhere but at their end
+ * throws CANNOT_WRITE_FILE.
+ */
+class File {
+    public:
+        static constexpr size_t DEFAULT_BUFFER_SIZE = 4096;
+        static constexpr size_t DEFAULT_READ_AHEAD = 8192;
+
+        /**
+         * @brief Construct a closed file handle
+         *
+         */
+        File();
+
+        /**
+         * @brief Construct a file handle and open a virtual file
+         *
+         * @param path the path of the virtual file
+         * @param mode how to open the file
+         * @param bufferSize the size of the buffer in bytes, 0 to disable buffering
+         */
+        File(std::string_view path, Mode mode = Mode::READ, size_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+        File(File&& other) noexcept;
+        File& operator=(File&& other) noexcept;
+
+        /**
+         * @brief Close the file, writing any buffered data
+         *
+         * Errors are ignored, call close() first to handle them.
+         */
+        ~File();
+
+        /**
+         * @brief Open a virtual file, closing the file that was open before
+         *
+         * @param path the path of the virtual file
+         * @param mode how to open the file
+         * @param bufferSize the size of the buffer in bytes, 0 to disable buffering
+         */
+        void open(std::string_view path, Mode mode = Mode::READ, size_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+        /**
+         * @brief Check if a file is open
+         *
+         * @return true a file is open
+         * @return false the handle is closed
+         */
+        bool isOpen() const;
+
+        /**
+         * @brief Read from the current position
+         *
+         * @param data where to store the bytes read
+         * @param size the number of bytes to read
+         * @return size_t the number of bytes read, less than size at the end of the file
+         */
+        size_t read(void* data, size_t size);
+
+        /**
+         * @brief Write at the current position
+         *
+         * @param data the bytes to write
+         * @param size the number of bytes to write
+         */
+        void write(const void* data, size_t size);
+
+        /**
+         * @brief Write a string at the current position
+         *
+         * @param data the string to write
+         */
+        void write(std::string_view data);
+
+        /**
+         * @brief Move the current position
+         *
+         * @param position the new position, in bytes from the start of the file
+         */
+        void seek(size_t position);
+
+        /**
+         * @brief Get the current position
+         *
+         * @return size_t the current position, in bytes from the start of the file
+         */
+        size_t tell() const;
+
+        /**
+         * @brief Get the size of the file, including buffered data
+         *
+         * @return size_t the size of the file in bytes
+         */
+        size_t size() const;
+
+        /**
+         * @brief Write any buffered data to the SD card
+         *
+         * With write-behind enabled, this waits until the flush task has written all the data queued by this handle.
+         * For compressed files, this ends the current frame, so flushing often makes them compress worse.
+         */
+        void flush();
+
+        /**
+         * @brief Enable or disable write-behind for the open file
+         *
+         * With write-behind enabled, data that would be written to the sector file is copied to the write-behind queue
+         * instead, and a low priority task writes it to the SD card. Reads, flush() and close() wait for the queued
+         * data of this handle to be written first, and report write errors of the flush task. Reopening the handle
+         * disables write-behind, and it has no effect on files opened for reading or compressed files, whose frames
+         * must not be dropped.
+         *
+         * @param enabled whether to enable write-behind
+         */
+        void setWriteBehind(bool enabled);
+
+        /**
+         * @brief Set how far ahead of sequential reads the file is prefetched
+         *
+         * Once the handle has read the file sequentially a few times, a low priority task reads the next bytes of the
+         * file into the block cache before they are asked for, so streaming a large file does not wait for the SD card
+         * on every read. Prefetching needs a cache, see initVFS(). Reopening the handle restores the default window.
+         *
+         * @param bytes the size of the window in bytes, 0 to disable read-ahead
+         */
+        void setReadAhead(size_t bytes);
+
+        /**
+         * @brief Write any buffered data and close the file
+         *
+         */
+        void close();
+    private:
+        // reads the path the handle was opened with, so queued operations on the handle stay ordered with operations
+        // on its path
+        friend AsyncResult queueAsync(AsyncRequest* request);
+
+        /**
+         * @brief Write the buffer to the sector file if it holds written data, then empty it
+         *
+         */
+        void flushBuffer();
+
+        /**
+         * @brief Wait until the write-behind queue holds no data of this handle
+         *
+         * @return true all the queued writes succeeded
+         * @return false a queued write failed
+         */
+        bool waitForWriteBehind();
+
+        /**
+         * @brief Get where the data of the file is stored
+         *
+         * @return FileStorage the storage of the file
+         */
+        FileStorage storage();
+
+        /**
+         * @brief Get the size of the file as stored on the SD card, not including buffered or queued data
+         *
+         * @return size_t the size of the file in bytes
+         */
+        size_t storedSize();
+
+        /**
+         * @brief Turn an inline file into a sector file if a write would make it larger than the inline threshold
+         *
+         * @param end the end of the write
+         */
+        void promoteIfNeeded(size_t end);
+
+        /**
+         * @brief Prefetch the file ahead of the current position if it is being read sequentially
+         *
+         */
+        void readAhead();
+
+        /**
+         * @brief Find the frame of a compressed file holding a position and decompress it into the buffer
+         *
+         * @param position the position, which must be less than the size of the file
+         */
+        void loadFrame(size_t position);
+
+        /**
+         * @brief Read the header of the frame of a compressed file at m_frameStored
+         *
+         * @param rawSize set to the size of the data in the frame
+         * @param storedSize set to the size of the frame on the SD card, including its header
+         * @return true there is a frame
+         * @return false the file ends here, or the rest of it was torn by a brown out
+         */
+        bool readFrameHeader(size_t& rawSize, size_t& storedSize);
+
+        std::string m_path;
+        // the normalized path the handle was opened with
+        std::string m_openedPath;
+        std::fstream m_stream;
+        // guards m_stream, which the write-behind and read-ahead tasks use too, and stays with the handle when moved
+        pros::Mutex m_streamMutex;
+        Mode m_mode = Mode::READ;
+        bool m_open = false;
+        // the buffer holds either data read from the file or data waiting to be written, starting at m_bufferStart
+        std::vector<char> m_buffer;
+        size_t m_bufferStart = 0;
+        size_t m_bufferLength = 0;
+        bool m_bufferDirty = false;
+        size_t m_position = 0;
+        // size of the sector file, not including data still in the buffer
+        size_t m_size = 0;
+        uint32_t m_sector = 0;
+        // whether the file is stored in the containers instead of its own sector file
+        bool m_container = false;
+        // whether the file is stored in the index until it grows
+        bool m_inline = false;
+        // whether the sector file has space reserved past the data
+        bool m_reserved = false;
+        // set while write-behind is enabled
+        std::unique_ptr<WriteBehindTarget> m_writeBehind;
+        size_t m_readAhead = DEFAULT_READ_AHEAD;
+        // where the last read ended, the number of reads in a row that started there, and where prefetching ends
+        size_t m_lastReadEnd = 0;
+        size_t m_sequentialReads = 0;
+        size_t m_prefetchedTo = 0;
+        // for compressed files, m_size is the size of the data, and m_storedEnd the size of the frames on the SD card.
+        // m_frameRaw and m_frameStored are the start of a frame in the data and on the SD card, used to find frames
+        bool m_compressed = false;
+        size_t m_storedEnd = 0;
+        size_t m_frameRaw = 0;
+        size_t m_frameStored = 0;
+        std::vector<char> m_frame;
+};
+
+/**
+ * @brief Priority classes of the operations queued to the VFS I/O task
+ *
+ * REALTIME is meant for reads a control loop is waiting on, INTERACTIVE for operations the driver or a routine will
+ * notice, and BACKGROUND for bulk work like flushing logs. Queued operations of a lower class only run once no
+ * operation of a higher class is queued.
+ */
+enum class IoPriority { REALTIME, INTERACTIVE, BACKGROUND };
+
+/**
+ * @brief How an operation is scheduled on the VFS I/O task
+ *
+ */
+struct IoOptions {
+        IoPriority priority = IoPriority::INTERACTIVE;
+        // milliseconds after it is queued that the operation should complete by, 0 for no deadline
+        uint32_t deadline = 0;
+};
+
+/**
+ * @brief Counters of the VFS I/O task, indexed by IoPriority
+ *
+ */
+struct IoStats {
+        // operations completed
+        size_t completed[3];
+        // operations completed after their deadline
+        size_t missedDeadlines[3];
+        // reads and writes run as part of a single read or write of the same handle
+        size_t merged;
+};
+
+/**
+ * @brief Get the counters of the VFS I/O task
+ *
+ * @return IoStats the counters
+ */
+IoStats getIoStats();
+
+/**
+ * @brief Reset the counters of the VFS I/O task
+ *
+ */
+void resetIoStats();
+
+/**
+ * @brief Completion token of an operation queued to the VFS I/O task
+ *
+ * A low priority task runs the queued operations one at a time. The next operation is the one with the highest priority
+ * class, then the earliest deadline, then the one queued first, but an operation never overtakes an earlier one on the
+ * same handle or file, which runs first instead. A handle counts as the file it was opened with, so a write does not
+ * overtake a delete of its file. Reads or writes queued back to back on a handle are merged into a single read or write
+ * of the file. When the operation completes, the I/O task notifies the task that queued it with
+ * pros::Task::notify(), so a loop can block on pros::Task::notify_take() or simply check ready() on its next cycle.
+ * wait() blocks on that notification, notifying the waiting task instead if the token was moved to another task.
+ * Destroying a token that is not ready waits for its operation, so the buffers it uses are never written after they go
+ * out of scope.
+ */
+class AsyncResult {
+    public:
+        /**
+         * @brief Construct a token without an operation, which is always ready
+         *
+         */
+        AsyncResult() = default;
+
+        AsyncResult(const AsyncResult&) = delete;
+        AsyncResult& operator=(const AsyncResult&) = delete;
+        AsyncResult(AsyncResult&& other) noexcept;
+        AsyncResult& operator=(AsyncResult&& other) noexcept;
+
+        /**
+         * @brief Wait for the operation and release the token
+         *
+         */
+        ~AsyncResult();
+
+        /**
+         * @brief Check if the operation has completed, without waiting
+         *
+         * @return true the operation has completed, wait() returns immediately
+         * @return false the operation is queued or running
+         */
+        bool ready() const;
+
+        /**
+         * @brief Wait for the operation to complete
+         *
+         * Throws the exception the operation failed with, if any.
+         *
+         * @return size_t the number of bytes read or written, 0 for other operations
+         */
+        size_t wait();
+
+        /**
+         * @brief Check if the operation completed after its deadline
+         *
+         * @return true the operation has completed, after its deadline
+         * @return false the operation is not ready, has no deadline or met it
+         */
+        bool missedDeadline() const;
+    private:
+        friend AsyncResult queueAsync(AsyncRequest* request);
+
+        /**
+         * @brief Construct a token for a queued operation
+         *
+         * @param request the queued operation
+         */
+        explicit AsyncResult(AsyncRequest* request);
+
+        /**
+         * @brief Wait for the operation and give its request back to the pool
+         *
+         */
+        void release();
+
+        AsyncRequest* m_request = nullptr;
+};
+
+/**
+ * @brief Read from the current position of a file on the VFS I/O task
+ *
+ * The handle and the buffer must not be used until the operation completes.
+ *
+ * @param file the file, open or opened by an openAsync() queued before, or the operation fails with FILE_NOT_OPEN
+ * @param data where to store the bytes read
+ * @param size the number of bytes to read
+ * @param options how the operation is scheduled
+ * @return AsyncResult the token of the operation, whose result is the number of bytes read
+ */
+AsyncResult readAsync(File& file, void* data, size_t size, const IoOptions& options = {});
+
+/**
+ * @brief Write at the current position of a file on the VFS I/O task
+ *
+ * The handle and the data must not be used or changed until the operation completes.
+ *
+ * @param file the file, open or opened by an openAsync() queued before, or the operation fails with FILE_NOT_OPEN
+ * @param data the bytes to write
+ * @param size the number of bytes to write
+ * @param options how the operation is scheduled
+ * @return AsyncResult the token of the operation, whose result is the number of bytes written
+ */
+AsyncResult writeAsync(File& file, const void* data, size_t size, const IoOptions& options = {});
+
+/**
+ * @brief Write the buffered data of a file to the SD card on the VFS I/O task
+ *
+ * The handle must not be used until the operation completes.
+ *
+ * @param file the file, open or opened by an openAsync() queued before, or the operation fails with FILE_NOT_OPEN
+ * @param options how the operation is scheduled
+ * @return AsyncResult the token of the operation
+ */
+AsyncResult flushAsync(File& file, const IoOptions& options = {});
+
+/**
+ * @brief Open a virtual file on the VFS I/O task, closing the file that was open before
+ *
+ * The handle must not be used until the operation completes.
+ *
+ * @param file the handle to open the file with
+ * @param path the path of the virtual file, copied before the call returns
+ * @param mode how to open the file
+ * @param bufferSize the size of the buffer in bytes, 0 to disable buffering
+ * @param options how the operation is scheduled
+ * @return AsyncResult the token of the operation
+ */
+AsyncResult openAsync(File& file, std::string_view path, Mode mode = Mode::READ,
+                      size_t bufferSize = File::DEFAULT_BUFFER_SIZE, const IoOptions& options = {});
+
+/**
+ * @brief Create a virtual file on the VFS I/O task
+ *
+ * @param path the path of the virtual file, copied before the call returns
+ * @param overwrite whether to replace a file that already exists at the path
+ * @param options how the operation is scheduled
+ * @return AsyncResult the token of the operation
+ */
+AsyncResult createFileAsync(std::string_view path, bool overwrite = true, const IoOptions& options = {});
+
+/**
+ * @brief Delete a virtual file on the VFS I/O task
+ *
+ * @param path the path of the virtual file, copied before the call returns
+ * @param options how the operation is scheduled
+ * @return AsyncResult the token of the operation
+ */
+AsyncResult deleteFileAsync(std::string_view path, const IoOptions& options = {});
+
+/**
+ * @brief Writes fixed size binary records to a virtual file from a background task
+ *
+ * log() copies a record into a single producer, single consumer ring buffer, without allocating, locking or touching
+ * the SD card, so it can be called from a control loop. A low priority task periodically appends the records in the
+ * ring to the file in batches. Only one task may call log(), and records that do not fit in the ring are dropped.
+ */
+class Logger {
+    public:
+        /**
+         * @brief Open a virtual file for appending and start the task that writes to it
+         *
+         * @param path the path of the virtual file
+         * @param recordSize the size of each record in bytes
+         * @param capacity the number of records the ring holds, rounded up to a power of 2
+         * @param interval how often the ring is written to the file, in milliseconds
+         * @param priority the priority of the task that writes to the file
+         */
+        Logger(std::string_view path, size_t recordSize, size_t capacity = 256, uint32_t interval = 20,
+               uint32_t priority = TASK_PRIORITY_MIN);
+
+        Logger(const Logger&) = delete;
+        Logger& operator=(const Logger&) = delete;
+
+        /**
+         * @brief Write the remaining records, stop the task and close the file
+         *
+         */
+        ~Logger();
+
+        /**
+         * @brief Copy a record into the ring
+         *
+         * @param record the record, recordSize bytes long
+         * @return true the record was queued
+         * @return false the ring was full and the record was dropped
+         */
+        bool log(const void* record);
+
+        /**
+         * @brief Copy a record into the ring
+         *
+         * @tparam T a trivially copyable type that is recordSize bytes long
+         * @param record the record
+         * @return true the record was queued
+         * @return false the ring was full and the record was dropped
+         */
+        template <typename T> bool log(const T& record) {
+            static_assert(std::is_trivially_copyable_v<T>, "records are copied byte by byte");
+            return log(static_cast<const void*>(&record));
+        }
+
+        /**
+         * @brief Wait until every record logged before the call is written to the SD card
+         *
+         * Throws if the task failed to write a record since the last call.
+         */
+        void flush();
+
+        /**
+         * @brief Get the number of records dropped because the ring was full
+         *
+         * @return size_t the number of dropped records
+         */
+        size_t dropped() const;
+    private:
+        /**
+         * @brief Body of the task that writes the ring to the file
+         *
+         */
+        void run();
+
+        /**
+         * @brief Write the records in the ring to the file
+         *
+         */
+        void writeRecords();
+
+        File m_file;
+        const size_t m_recordSize;
+        const uint32_t m_interval;
+        uint32_t m_mask;
+        std::vector<char> m_records;
+        // count of records taken by the task and added by log(), the ring holds the records between them
+        std::atomic<uint32_t> m_head = 0;
+        std::atomic<uint32_t> m_tail = 0;
+        std::atomic<uint32_t> m_dropped = 0;
+        // flush() waits until the task has flushed the file past the records it requested
+        std::atomic<uint32_t> m_flushRequested = 0;
+        std::atomic<uint32_t> m_flushed = 0;
+        std::atomic<bool> m_failed = false;
+        std::atomic<bool> m_stop = false;
+        std::atomic<bool> m_stopped = false;
+};
+
+/**
+ * @brief Writes fixed-schema numeric samples to a virtual file, column by column
+ *
+ * Each sample is a timestamp followed by a fixed number of values. Values are stored as integers, rounded after
+ * multiplying them by the scale of their column, so a scale of 1000 keeps 3 decimal places. Samples are gathered into
+ * blocks, and each block stores the timestamps as zigzag varints of their delta of delta, then each column of values as
+ * zigzag varints of their deltas. Slowly changing samples at a fixed rate take a few bytes each instead of 4 per value.
+ * Blocks are decoded on their own and checksummed, so a brown out only loses the block being written.
+ */
+class TimeSeriesWriter {
+    public:
+        /**
+         * @brief Create a time series file, replacing the file at the path
+         *
+         * @param path the path of the virtual file
+         * @param scales the scale of each column of values, the number of scales is the number of values per sample
+         * @param blockSamples the number of samples gathered before a block is written
+         */
+        TimeSeriesWriter(std::string_view path, const std::vector<float>& scales, size_t blockSamples = 128);
+
+        /**
+         * @brief Write the last block and close the file
+         *
+         * Errors are ignored, call close() first to handle them.
+         */
+        ~TimeSeriesWriter();
+
+        /**
+         * @brief Add a sample
+         *
+         * @param timestamp the time of the sample, usually pros::millis()
+         * @param values one value per column
+         */
+        void write(uint32_t timestamp, const float* values);
+
+        /**
+         * @brief Write the samples gathered so far as a block and flush the file
+         *
+         */
+        void flush();
+
+        /**
+         * @brief Enable or disable write-behind for the file, see File::setWriteBehind()
+         *
+         * @param enabled whether to enable write-behind
+         */
+        void setWriteBehind(bool enabled);
+
+        /**
+         * @brief Write the last block and close the file
+         *
+         */
+        void close();
+    private:
+        /**
+         * @brief Encode the gathered samples as a block and write it
+         *
+         */
+        void writeBlock();
+
+        File m_file;
+        std::vector<float> m_scales;
+        size_t m_blockSamples;
+        // the gathered samples, and their values scaled to integers, sample by sample
+        std::vector<uint32_t> m_timestamps;
+        std::vector<int32_t> m_values;
+        std::vector<char> m_block;
+};
+
+/**
+ * @brief Reads the samples of a file written by TimeSeriesWriter back, one at a time
+ *
+ * Only one block is decoded in memory at a time. Reading stops at the end of the file, or at a block torn by a brown
+ * out, including one cut off at the end of the file. A block header whose sample count can't match its size makes
+ * read() throw instead, once the samples before it were read.
+ */
+class TimeSeriesReader {
+    public:
+        /**
+         * @brief Open a time series file
+         *
+         * @param path the path of the virtual file
+         */
+        TimeSeriesReader(std::string_view path);
+
+        /**
+         * @brief Get the number of values per sample
+         *
+         * @return size_t the number of columns of values
+         */
+        size_t columns() const;
+
+        /**
+         * @brief Read the next sample
+         *
+         * @param timestamp set to the time of the sample
+         * @param values set to the values of the sample, columns() of them
+         * @return true a sample was read
+         * @return false there are no more samples
+         */
+        bool read(uint32_t& timestamp, float* values);
+    private:
+        /**
+         * @brief Read and decode the next block
+         *
+         * @return true a block was decoded
+         * @return false there are no more intact blocks
+         */
+        bool readBlock();
 
-}
-} // namespace lemlib
\ No newline at end of file
+        std::string m_path;
+        File m_file;
+        std::vector<float> m_scales;
+        std::vector<uint32_t> m_timestamps;
+        std::vector<int32_t> m_values;
+        std::vector<char> m_block;
+        // the next sample of the decoded block
+        size_t m_next = 0;
+};
+} // namespace fs
+} // namespace lemlib
@@ -0,0 +1,246 @@
+#pragma once
+
+#include "lemlib/vfs.hpp"
+#include "pros/rtos.hpp"
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Coroutines that co_await operations of the VFS I/O task
+ *
+ * Kept out of lemlib/vfs.hpp, since including <coroutine> needs -fcoroutines on some compilers.
+ */
+
+namespace lemlib {
+namespace fs {
+class CoroutineScheduler;
+
+/**
+ * @brief A coroutine run by a CoroutineScheduler
+ *
+ * Any function returning a Coroutine that uses co_await is one. Calling it creates the coroutine without running it,
+ * and CoroutineScheduler::spawn() runs it. Coroutine frames are allocated from a pool that keeps freed frames for the
+ * next coroutines, so creating a coroutine only allocates when more of them are alive than ever before. See
+ * setCoroutineFramePool() to allocate them from the heap instead.
+ */
+class Coroutine {
+    public:
+        struct promise_type {
+                Coroutine get_return_object() {
+                    return Coroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+                }
+
+                std::suspend_always initial_suspend() noexcept { return {}; }
+
+                std::suspend_always final_suspend() noexcept { return {}; }
+
+                void return_void() {}
+
+                void unhandled_exception() { failed = true; }
+
+                /**
+                 * @brief Allocate a coroutine frame from the pool
+                 *
+                 * @param size the size of the frame in bytes
+                 * @return void* the frame
+                 */
+                static void* operator new(size_t size);
+
+                /**
+                 * @brief Give a coroutine frame back to the pool
+                 *
+                 * @param frame the frame
+                 * @param size the size of the frame in bytes
+                 */
+                static void operator delete(void* frame, size_t size);
+
+                // set when spawned, the scheduler the coroutine runs on
+                CoroutineScheduler* scheduler = nullptr;
+                // set when an exception escapes the coroutine, which ends it
+                bool failed = false;
+        };
+
+        Coroutine(const Coroutine&) = delete;
+        Coroutine& operator=(const Coroutine&) = delete;
+        Coroutine(Coroutine&& other) noexcept;
+        Coroutine& operator=(Coroutine&& other) noexcept;
+
+        /**
+         * @brief Destroy the coroutine if it was never spawned
+         *
+         */
+        ~Coroutine();
+    private:
+        friend class CoroutineScheduler;
+
+        explicit Coroutine(std::coroutine_handle<promise_type> handle);
+
+        std::coroutine_handle<promise_type> m_handle;
+};
+
+/**
+ * @brief Set whether coroutine frames are allocated from the pool
+ *
+ * The pool keeps freed frames of up to 2 KiB in size classes, so creating a coroutine does not take the lock of the
+ * heap and does not fragment it. Without the pool, every frame comes from operator new and goes back to the heap when
+ * its coroutine is destroyed. Frames are rounded up to their size class either way, so the pool can be toggled while
+ * coroutines are alive. Disabling it gives the frames it keeps back to the heap.
+ *
+ * @param enabled whether to pool frames, true by default
+ */
+void setCoroutineFramePool(bool enabled);
+
+/**
+ * @brief Check if coroutine frames are allocated from the pool
+ *
+ * @return true frames are pooled
+ * @return false frames are allocated from the heap
+ */
+bool getCoroutineFramePool();
+
+/**
+ * @brief Runs coroutines cooperatively on a single task
+ *
+ * A coroutine runs until it co_awaits an AsyncResult or a delay, then the scheduler runs the next coroutine that is
+ * ready. Operations queued by a coroutine notify the scheduler task when they complete, so the task sleeps while every
+ * coroutine is waiting. A coroutine that blocks, for example by calling File::read() directly, holds up all the others.
+ */
+class CoroutineScheduler {
+    public:
+        /**
+         * @brief Awaitable that resumes the coroutine after a delay
+         *
+         */
+        struct Delay {
+                uint32_t milliseconds;
+
+                bool await_ready() const noexcept { return false; }
+
+                void await_suspend(std::coroutine_handle<Coroutine::promise_type> handle) const;
+
+                void await_resume() const noexcept {}
+        };
+
+        /**
+         * @brief Awaitable that resumes the coroutine once an operation of the VFS I/O task completes
+         *
+         * await_resume() returns the result of the operation, or throws the exception it failed with.
+         */
+        struct Completion {
+                AsyncResult& result;
+
+                bool await_ready() const { return result.ready(); }
+
+                void await_suspend(std::coroutine_handle<Coroutine::promise_type> handle) const;
+
+                size_t await_resume() const { return result.wait(); }
+        };
+
+        /**
+         * @brief Start the task that runs the coroutines
+         *
+         * @param priority the priority of the task
+         */
+        CoroutineScheduler(uint32_t priority = TASK_PRIORITY_DEFAULT);
+
+        CoroutineScheduler(const CoroutineScheduler&) = delete;
+        CoroutineScheduler& operator=(const CoroutineScheduler&) = delete;
+
+        /**
+         * @brief Stop the task and destroy the coroutines that have not finished
+         *
+         * Destroying a coroutine waits for the operation it is waiting on, if any.
+         */
+        ~CoroutineScheduler();
+
+        /**
+         * @brief Run a coroutine on the scheduler, from any task
+         *
+         * @param coroutine the coroutine, which must not have been spawned before
+         */
+        void spawn(Coroutine coroutine);
+
+        /**
+         * @brief Get the number of spawned coroutines that have not finished
+         *
+         * @return size_t the number of coroutines
+         */
+        size_t running() const;
+
+        /**
+         * @brief Get the number of coroutines that ended because an exception escaped them
+         *
+         * @return size_t the number of coroutines
+         */
+        size_t failures() const;
+
+        /**
+         * @brief Suspend the calling coroutine for a while
+         *
+         * co_await delay(0) lets the other ready coroutines run before resuming.
+         *
+         * @param milliseconds how long to suspend the coroutine for
+         * @return Delay the awaitable
+         */
+        static Delay delay(uint32_t milliseconds) { return {milliseconds}; }
+    private:
+        /**
+         * @brief A coroutine waiting on an operation or a delay
+         *
+         * @param handle the coroutine
+         * @param result the operation, or nullptr for a delay
+         * @param wake when the delay ends
+         */
+        struct Waiting {
+                std::coroutine_handle<Coroutine::promise_type> handle;
+                const AsyncResult* result;
+                uint32_t wake;
+        };
+
+        /**
+         * @brief Body of the task that runs the coroutines
+         *
+         */
+        void run();
+
+        /**
+         * @brief Resume a coroutine, destroying it if it finished
+         *
+         * @param handle the coroutine
+         */
+        void resume(std::coroutine_handle<Coroutine::promise_type> handle);
+
+        pros::Mutex m_spawnMutex;
+        // coroutines spawned since the task last looked, guarded by m_spawnMutex
+        std::vector<std::coroutine_handle<Coroutine::promise_type>> m_spawned;
+        // only used by the task
+        std::vector<std::coroutine_handle<Coroutine::promise_type>> m_ready;
+        std::vector<std::coroutine_handle<Coroutine::promise_type>> m_resuming;
+        std::vector<Waiting> m_waiting;
+        std::atomic<size_t> m_running = 0;
+        std::atomic<size_t> m_failures = 0;
+        std::atomic<bool> m_stop = false;
+        std::atomic<bool> m_stopped = false;
+        pros::Task m_task;
+};
+
+/**
+ * @brief co_await an operation of the VFS I/O task from a coroutine run by a CoroutineScheduler
+ *
+ * @param result the token of the operation, which must stay alive until the coroutine resumes
+ * @return CoroutineScheduler::Completion the awaitable
+ */
+inline CoroutineScheduler::Completion operator co_await(AsyncResult& result) { return {result}; }
+
+/**
+ * @brief co_await an operation of the VFS I/O task from a coroutine run by a CoroutineScheduler
+ *
+ * @param result the token of the operation, like co_await readAsync(file, data, size)
+ * @return CoroutineScheduler::Completion the awaitable
+ */
+inline CoroutineScheduler::Completion operator co_await(AsyncResult&& result) { return {result}; }
+} // namespace fs
+} // namespace lemlib
@@ -0,0 +1,433 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       async.cpp                                                 */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Operations queued to the VFS I/O task                     */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "lemlib/vfs.hpp"
+#include "vfs_internal.hpp"
+#include "pros/rtos.hpp"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string.h>
+
+namespace lemlib {
+namespace fs {
+enum class AsyncOperation { READ, WRITE, FLUSH, OPEN, CREATE, DELETE, COMPACT };
+
+/**
+ * @brief An operation queued to the I/O task
+ *
+ * The requester fills in the operation before queueing it. The I/O task sets result, failed and error before it sets
+ * done, and the requester only reads them once it sees done.
+ */
+struct AsyncRequest {
+        AsyncOperation operation;
+        File* file;
+        // where a read stores its bytes, and the bytes of a write
+        void* out;
+        const void* in;
+        size_t size;
+        // the normalized path of an open, create or delete, or of the file a handle was opened with
+        std::string path;
+        Mode mode;
+        size_t bufferSize;
+        bool overwrite;
+        // the task notified when the operation completes, or nullptr if nothing waits for it, guarded by queueMutex
+        pros::task_t requester;
+        IoPriority priority;
+        // the time the operation should complete by, if it has a deadline
+        bool hasDeadline;
+        uint32_t deadline;
+        size_t result;
+        bool failed;
+        std::string error;
+        bool missedDeadline;
+        std::atomic<bool> done = false;
+};
+
+static pros::Mutex queueMutex;
+static std::optional<pros::Task> ioTask;
+// requests are never freed, so queueing only allocates when more operations are outstanding than ever before
+static std::vector<std::unique_ptr<AsyncRequest>> pool;
+static std::vector<AsyncRequest*> freeRequests;
+static std::vector<AsyncRequest*> queued;
+// the operations the I/O task is running, until they are done
+static std::vector<AsyncRequest*> running;
+static IoStats ioStats = {};
+
+// reads and writes are only merged up to this size, so a merged operation does not hold up the queue for long
+static constexpr size_t MAX_MERGED_SIZE = 16384;
+
+/**
+ * @brief Check if an operation should run before another one, ignoring the order they were queued in
+ *
+ */
+static bool runsBefore(const AsyncRequest& a, const AsyncRequest& b) {
+    if (a.priority != b.priority) return a.priority < b.priority;
+    if (a.hasDeadline != b.hasDeadline) return a.hasDeadline;
+    // the clock wraps around, so deadlines are compared by their difference
+    return a.hasDeadline && static_cast<int32_t>(a.deadline - b.deadline) < 0;
+}
+
+/**
+ * @brief Check if two operations must run in the order they were queued in
+ *
+ */
+static bool conflicts(const AsyncRequest& a, const AsyncRequest& b) {
+    if (a.file != nullptr && a.file == b.file) return true;
+    // handle operations carry the path of their file, so they conflict with operations on the path too
+    return !a.path.empty() && a.path == b.path;
+}
+
+/**
+ * @brief Store the normalized path of an operation, reusing the string of the request
+ *
+ */
+static void setPath(AsyncRequest& request, std::string_view path) {
+    request.path.assign(1, '/');
+    request.path.append(pathKey(path));
+}
+
+/**
+ * @brief Choose the next operation to run
+ *
+ * Must be called with the queue locked and not empty.
+ *
+ * @return size_t the index of the operation in the queue
+ */
+static size_t pickRequest() {
+    size_t best = 0;
+    for (size_t i = 1; i < queued.size(); i++)
+        if (runsBefore(*queued[i], *queued[best])) best = i;
+    // the earliest operation the chosen one depends on runs first, which may depend on an even earlier one
+    size_t i = 0;
+    while (i < best) {
+        if (conflicts(*queued[i], *queued[best])) {
+            best = i;
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Take the next operation out of the queue, along with the reads or writes that can be merged with it
+ *
+ * Must be called with the queue locked and not empty.
+ *
+ * @param batch set to the operations to run, in the order they were queued
+ */
+static void takeBatch(std::vector<AsyncRequest*>& batch) {
+    const size_t first = pickRequest();
+    AsyncRequest* request = queued[first];
+    batch.assign(1, request);
+    // the operations on the same handle after the chosen one, up to the first operation that must run between them
+    if (request->operation == AsyncOperation::READ || request->operation == AsyncOperation::WRITE) {
+        size_t total = request->size;
+        for (size_t i = first + 1; i < queued.size(); i++) {
+            AsyncRequest* next = queued[i];
+            if (next->file != request->file) {
+                if (conflicts(*next, *request)) break;
+                continue;
+            }
+            if (next->operation != request->operation || total + next->size > MAX_MERGED_SIZE) break;
+            total += next->size;
+            batch.push_back(next);
+        }
+    }
+    // the batch is in queue order, so it is removed back to front
+    for (size_t i = batch.size(); i-- > 0;) queued.erase(std::find(queued.begin() + first, queued.end(), batch[i]));
+    ioStats.merged += batch.size() - 1;
+}
+
+/**
+ * @brief Run an operation, catching the exception it fails with
+ *
+ */
+static void runRequest(AsyncRequest& request) {
+    request.result = 0;
+    request.failed = false;
+    try {
+        switch (request.operation) {
+            case AsyncOperation::READ: request.result = request.file->read(request.out, request.size); break;
+            case AsyncOperation::WRITE:
+                request.file->write(request.in, request.size);
+                request.result = request.size;
+                break;
+            case AsyncOperation::FLUSH: request.file->flush(); break;
+            case AsyncOperation::OPEN: request.file->open(request.path, request.mode, request.bufferSize); break;
+            case AsyncOperation::CREATE: ::createFile(request.path, request.overwrite); break;
+            case AsyncOperation::DELETE: ::deleteFile(request.path); break;
+            case AsyncOperation::COMPACT: ::compactQueuedIndex(); break;
+        }
+    } catch (const VFSException& e) {
+        request.error = e.what();
+        request.failed = true;
+    }
+}
+
+/**
+ * @brief Run merged reads or writes of a handle as a single read or write
+ *
+ * @param batch the operations, in the order they were queued
+ * @param staging holds the merged data
+ */
+static void runMerged(const std::vector<AsyncRequest*>& batch, std::vector<char>& staging) {
+    File& file = *batch[0]->file;
+    size_t total = 0;
+    for (AsyncRequest* request : batch) total += request->size;
+    staging.resize(total);
+    try {
+        if (batch[0]->operation == AsyncOperation::WRITE) {
+            size_t offset = 0;
+            for (AsyncRequest* request : batch) {
+                memcpy(staging.data() + offset, request->in, request->size);
+                offset += request->size;
+            }
+            file.write(staging.data(), total);
+            for (AsyncRequest* request : batch) request->result = request->size;
+        } else {
+            // a short read fills the earliest operations first, like separate reads would
+            size_t remaining = file.read(staging.data(), total);
+            size_t offset = 0;
+            for (AsyncRequest* request : batch) {
+                request->result = std::min(request->size, remaining);
+                memcpy(request->out, staging.data() + offset, request->result);
+                offset += request->result;
+                remaining -= request->result;
+            }
+        }
+        for (AsyncRequest* request : batch) request->failed = false;
+    } catch (const VFSException& e) {
+        for (AsyncRequest* request : batch) {
+            request->result = 0;
+            request->error = e.what();
+            request->failed = true;
+        }
+    }
+}
+
+/**
+ * @brief Run the queued operations, highest priority first
+ *
+ */
+static void ioLoop() {
+    // the batch is reused, so running operations allocates only until it has seen the largest batch
+    std::vector<AsyncRequest*>& batch = running;
+    std::vector<char> staging;
+    while (true) {
+        queueMutex.take();
+        if (queued.empty()) {
+            queueMutex.give();
+            pros::Task::notify_take(true, TIMEOUT_MAX);
+            continue;
+        }
+        takeBatch(batch);
+        queueMutex.give();
+
+        if (batch.size() == 1) runRequest(*batch[0]);
+        else runMerged(batch, staging);
+
+        const uint32_t now = pros::millis();
+        // the requests are given back to the pool with the queue locked, so none is reused before the batch is cleared
+        queueMutex.take();
+        for (AsyncRequest* request : batch) {
+            const size_t priority = static_cast<size_t>(request->priority);
+            request->missedDeadline = request->hasDeadline && static_cast<int32_t>(now - request->deadline) > 0;
+            ioStats.completed[priority]++;
+            if (request->missedDeadline) ioStats.missedDeadlines[priority]++;
+            if (request->requester == nullptr) {
+                freeRequests.push_back(request);
+                continue;
+            }
+            request->done.store(true, std::memory_order_release);
+            pros::Task(request->requester).notify();
+        }
+        batch.clear();
+        queueMutex.give();
+    }
+}
+
+/**
+ * @brief Take a request out of the pool
+ *
+ * @param operation the operation the request is for
+ * @param options how the operation is scheduled
+ * @return AsyncRequest* the request, owned by the caller until it is queued
+ */
+static AsyncRequest* takeRequest(AsyncOperation operation, const IoOptions& options) {
+    std::lock_guard<pros::Mutex> lock(queueMutex);
+    if (freeRequests.empty()) {
+        pool.push_back(std::make_unique<AsyncRequest>());
+        // every request can be free or queued at once, so neither list allocates when it is used
+        freeRequests.reserve(pool.size());
+        queued.reserve(pool.size());
+        freeRequests.push_back(pool.back().get());
+    }
+    AsyncRequest* request = freeRequests.back();
+    freeRequests.pop_back();
+    request->operation = operation;
+    request->requester = pros::c::task_get_current();
+    request->file = nullptr;
+    request->path.clear();
+    request->priority = options.priority;
+    request->hasDeadline = options.deadline != 0;
+    request->deadline = pros::millis() + options.deadline;
+    request->missedDeadline = false;
+    request->done.store(false, std::memory_order_relaxed);
+    return request;
+}
+
+/**
+ * @brief Add a request to the queue and wake the I/O task, starting it if needed
+ *
+ * Must be called with the queue locked, and gives the lock back.
+ *
+ * @param request the request, owned by the I/O task from now on
+ */
+static void pushRequest(AsyncRequest* request) {
+    if (!ioTask) ioTask.emplace(ioLoop, TASK_PRIORITY_MIN, TASK_STACK_DEPTH_DEFAULT, "VFS I/O");
+    queued.push_back(request);
+    queueMutex.give();
+    ioTask->notify();
+}
+
+AsyncResult queueAsync(AsyncRequest* request) {
+    queueMutex.take();
+    if (request->file != nullptr && request->operation != AsyncOperation::OPEN) {
+        // the handle is opened with the path of the last open queued on it, if any is still queued or running. The
+        // I/O task writes the path of the handle while running an open, so it is only read once no operation on the
+        // handle is left, and the queue lock orders the write before this read
+        const auto onFile = [request](const AsyncRequest* other) { return other->file == request->file; };
+        const auto last = std::find_if(queued.rbegin(), queued.rend(), onFile);
+        const auto current = std::find_if(running.rbegin(), running.rend(), onFile);
+        if (last != queued.rend()) request->path.assign((*last)->path);
+        else if (current != running.rend()) request->path.assign((*current)->path);
+        else request->path.assign(request->file->m_openedPath);
+    }
+    pushRequest(request);
+    return AsyncResult(request);
+}
+
+void queueCompaction() {
+    AsyncRequest* request = takeRequest(AsyncOperation::COMPACT, {IoPriority::BACKGROUND});
+    // no token waits for the compaction, so the I/O task gives the request back to the pool itself
+    request->requester = nullptr;
+    queueMutex.take();
+    pushRequest(request);
+}
+
+/**
+ * @brief Block until an operation is done
+ *
+ * The I/O task notifies the requester of the operation when it is done, so the waiting task becomes the requester
+ * first, in case the token was moved to another task.
+ */
+static void waitForRequest(AsyncRequest& request) {
+    if (request.done.load(std::memory_order_acquire)) return;
+    queueMutex.take();
+    request.requester = pros::c::task_get_current();
+    queueMutex.give();
+    // notifications of other operations may wake the task first
+    while (!request.done.load(std::memory_order_acquire)) pros::Task::notify_take(true, TIMEOUT_MAX);
+}
+
+AsyncResult::AsyncResult(AsyncRequest* request)
+    : m_request(request) {}
+
+AsyncResult::AsyncResult(AsyncResult&& other) noexcept
+    : m_request(other.m_request) {
+    other.m_request = nullptr;
+}
+
+AsyncResult& AsyncResult::operator=(AsyncResult&& other) noexcept {
+    if (this != &other) {
+        release();
+        m_request = other.m_request;
+        other.m_request = nullptr;
+    }
+    return *this;
+}
+
+AsyncResult::~AsyncResult() { release(); }
+
+bool AsyncResult::ready() const { return m_request == nullptr || m_request->done.load(std::memory_order_acquire); }
+
+bool AsyncResult::missedDeadline() const { return ready() && m_request != nullptr && m_request->missedDeadline; }
+
+size_t AsyncResult::wait() {
+    if (m_request == nullptr) return 0;
+    waitForRequest(*m_request);
+    if (m_request->failed) throw VFSException(m_request->error);
+    return m_request->result;
+}
+
+void AsyncResult::release() {
+    if (m_request == nullptr) return;
+    waitForRequest(*m_request);
+    std::lock_guard<pros::Mutex> lock(queueMutex);
+    freeRequests.push_back(m_request);
+    m_request = nullptr;
+}
+
+IoStats getIoStats() {
+    std::lock_guard<pros::Mutex> lock(queueMutex);
+    return ioStats;
+}
+
+void resetIoStats() {
+    std::lock_guard<pros::Mutex> lock(queueMutex);
+    ioStats = {};
+}
+
+AsyncResult readAsync(File& file, void* data, size_t size, const IoOptions& options) {
+    AsyncRequest* request = takeRequest(AsyncOperation::READ, options);
+    request->file = &file;
+    request->out = data;
+    request->size = size;
+    return queueAsync(request);
+}
+
+AsyncResult writeAsync(File& file, const void* data, size_t size, const IoOptions& options) {
+    AsyncRequest* request = takeRequest(AsyncOperation::WRITE, options);
+    request->file = &file;
+    request->in = data;
+    request->size = size;
+    return queueAsync(request);
+}
+
+AsyncResult flushAsync(File& file, const IoOptions& options) {
+    AsyncRequest* request = takeRequest(AsyncOperation::FLUSH, options);
+    request->file = &file;
+    return queueAsync(request);
+}
+
+AsyncResult openAsync(File& file, std::string_view path, Mode mode, size_t bufferSize, const IoOptions& options) {
+    AsyncRequest* request = takeRequest(AsyncOperation::OPEN, options);
+    request->file = &file;
+    setPath(*request, path);
+    request->mode = mode;
+    request->bufferSize = bufferSize;
+    return queueAsync(request);
+}
+
+AsyncResult createFileAsync(std::string_view path, bool overwrite, const IoOptions& options) {
+    AsyncRequest* request = takeRequest(AsyncOperation::CREATE, options);
+    setPath(*request, path);
+    request->overwrite = overwrite;
+    return queueAsync(request);
+}
+
+AsyncResult deleteFileAsync(std::string_view path, const IoOptions& options) {
+    AsyncRequest* request = takeRequest(AsyncOperation::DELETE, options);
+    setPath(*request, path);
+    return queueAsync(request);
+}
+} // namespace fs
+} // namespace lemlib
@@ -0,0 +1,368 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       cache.cpp                                                 */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Write-through block cache for virtual file contents       */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "lemlib/vfs.hpp"
+#include "vfs_internal.hpp"
+#include "pros/rtos.hpp"
+#include <algorithm>
+#include <mutex>
+#include <string.h>
+
+namespace lemlib {
+namespace fs {
+/**
+ * @brief Slot of the cache holding one block of a file
+ *
+ * @param sector the sector of the file
+ * @param block the number of the block in the file
+ * @param length the number of valid bytes, less than a block at the end of the file
+ * @param used whether the slot holds a block
+ * @param referenced whether the block was used since the clock hand last passed it
+ */
+struct CacheSlot {
+        uint32_t sector;
+        uint32_t block;
+        uint16_t length;
+        bool used;
+        bool referenced;
+};
+
+/**
+ * @brief State of the cache
+ *
+ * The budget is split into fixed slots allocated once, so caching never allocates. Blocks are found through an open
+ * addressing hash table over (sector, block) that works like the one over the index, and evicted with the CLOCK
+ * algorithm. Everything is guarded by cacheMutex, since the write-behind task writes through the cache too. Misses
+ * are read from the SD card without holding it, so a miss never makes readers of other blocks wait.
+ */
+static std::vector<CacheSlot> slots;
+static std::vector<char> blocks;
+static std::vector<int32_t> cacheTable;
+static size_t clockHand = 0;
+static size_t hits = 0;
+static size_t misses = 0;
+static pros::Mutex cacheMutex;
+
+/**
+ * @brief A read of the SD card made without holding the cache
+ *
+ * Reads in flight are linked through the stack frames of the readers, so tracking them never allocates. Writes to the
+ * file and changes to the whole cache mark them stale, since the blocks they read may be older than the cache.
+ *
+ * @param sector the sector of the file being read
+ * @param stale whether the blocks read must not be cached
+ * @param next the next read in flight
+ */
+struct InflightRead {
+        uint32_t sector;
+        bool stale;
+        InflightRead* next;
+};
+
+static InflightRead* inflightReads = nullptr;
+
+/**
+ * @brief Mark the reads in flight of a file stale
+ *
+ * Must be called with the cache locked.
+ */
+static void markStale(uint32_t sector) {
+    for (InflightRead* read = inflightReads; read != nullptr; read = read->next)
+        if (read->sector == sector) read->stale = true;
+}
+
+/**
+ * @brief Mark every read in flight stale
+ *
+ * Must be called with the cache locked.
+ */
+static void markAllStale() {
+    for (InflightRead* read = inflightReads; read != nullptr; read = read->next) read->stale = true;
+}
+
+/**
+ * @brief Read from the SD card with the cache unlocked, tracking the read so writes made meanwhile are noticed
+ *
+ * @param lock the lock of the cache, held when called and when returning, even if the read throws
+ * @param read the entry of the read, whose stale flag is valid once this returns
+ * @param storage the storage of the file
+ * @param offset where to start reading
+ * @param data where to store the bytes read
+ * @param size the number of bytes to read
+ * @return size_t the number of bytes read
+ */
+static size_t readUnlocked(std::unique_lock<pros::Mutex>& lock, InflightRead& read, const FileStorage& storage,
+                           size_t offset, char* data, size_t size) {
+    read = {storage.sector, false, inflightReads};
+    inflightReads = &read;
+    // relocks and unlinks the read however it ends
+    struct Relock {
+            std::unique_lock<pros::Mutex>& lock;
+            InflightRead& read;
+
+            ~Relock() {
+                lock.lock();
+                InflightRead** link = &inflightReads;
+                while (*link != &read) link = &(*link)->next;
+                *link = read.next;
+            }
+    } relock = {lock, read};
+    lock.unlock();
+    return readUncached(storage, offset, data, size);
+}
+
+/**
+ * @brief Hash a block of a file
+ *
+ */
+static uint32_t hashBlock(uint32_t sector, uint32_t block) {
+    uint32_t hash = sector * 2654435761u + block;
+    hash ^= hash >> 15;
+    return hash * 2246822519u;
+}
+
+/**
+ * @brief Find the slot of the hash table holding a block, or the empty slot where it would be inserted
+ *
+ */
+static size_t findTableSlot(uint32_t sector, uint32_t block) {
+    const size_t mask = cacheTable.size() - 1;
+    size_t i = hashBlock(sector, block) & mask;
+    while (cacheTable[i] != -1) {
+        const CacheSlot& slot = slots[cacheTable[i]];
+        if (slot.sector == sector && slot.block == block) break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Remove a block from the cache
+ *
+ * @param index the slot holding the block
+ */
+static void evictSlot(size_t index) {
+    const size_t mask = cacheTable.size() - 1;
+    size_t i = findTableSlot(slots[index].sector, slots[index].block);
+    // backward shift deletion, like the hash table over the index
+    for (size_t next = (i + 1) & mask; cacheTable[next] != -1; next = (next + 1) & mask) {
+        const CacheSlot& moved = slots[cacheTable[next]];
+        const size_t home = hashBlock(moved.sector, moved.block) & mask;
+        if (((next - home) & mask) >= ((next - i) & mask)) {
+            cacheTable[i] = cacheTable[next];
+            i = next;
+        }
+    }
+    cacheTable[i] = -1;
+    slots[index].used = false;
+}
+
+/**
+ * @brief Take a slot for a new block, evicting the first block the clock hand finds unreferenced
+ *
+ * @return size_t the slot, which is not in the hash table yet
+ */
+static size_t takeSlot() {
+    while (true) {
+        CacheSlot& slot = slots[clockHand];
+        const size_t index = clockHand;
+        clockHand = (clockHand + 1) % slots.size();
+        if (slot.used && slot.referenced) {
+            slot.referenced = false;
+            continue;
+        }
+        if (slot.used) evictSlot(index);
+        return index;
+    }
+}
+
+/**
+ * @brief Add a block to the cache
+ *
+ * @param index the slot taken for the block
+ * @param sector the sector of the file
+ * @param block the number of the block in the file
+ * @param length the number of valid bytes in the slot
+ */
+static void insertSlot(size_t index, uint32_t sector, uint32_t block, size_t length) {
+    slots[index] = {sector, block, static_cast<uint16_t>(length), true, true};
+    cacheTable[findTableSlot(sector, block)] = static_cast<int32_t>(index);
+}
+
+/**
+ * @brief Add blocks read from the SD card to the cache
+ *
+ * Blocks another task cached while they were read are kept if they hold at least as many bytes.
+ *
+ * @param sector the sector of the file
+ * @param block the number of the first block in the file
+ * @param data the blocks
+ * @param size the number of bytes read
+ * @param referenced whether the blocks were asked for, prefetched blocks are evicted first if they are never read
+ */
+static void cacheBlocks(uint32_t sector, uint32_t block, const char* data, size_t size, bool referenced) {
+    for (size_t i = 0; i * CACHE_BLOCK_SIZE < size; i++) {
+        const size_t length = std::min(CACHE_BLOCK_SIZE, size - i * CACHE_BLOCK_SIZE);
+        const int32_t found = cacheTable[findTableSlot(sector, block + i)];
+        if (found != -1) {
+            if (slots[found].length >= length) continue;
+            evictSlot(found);
+        }
+        const size_t index = takeSlot();
+        memcpy(blocks.data() + index * CACHE_BLOCK_SIZE, data + i * CACHE_BLOCK_SIZE, length);
+        insertSlot(index, sector, block + i, length);
+        slots[index].referenced = referenced;
+    }
+}
+
+void configureCache(size_t bytes) {
+    std::lock_guard<pros::Mutex> lock(cacheMutex);
+    const size_t count = bytes / CACHE_BLOCK_SIZE;
+    markAllStale();
+    slots.assign(count, {0, 0, 0, false, false});
+    blocks.assign(count * CACHE_BLOCK_SIZE, 0);
+    size_t tableSize = 1;
+    while (tableSize < count * 2) tableSize *= 2;
+    cacheTable.assign(count > 0 ? tableSize : 0, -1);
+    clockHand = 0;
+}
+
+void clearCache() {
+    std::lock_guard<pros::Mutex> lock(cacheMutex);
+    markAllStale();
+    for (CacheSlot& slot : slots) slot.used = false;
+    std::fill(cacheTable.begin(), cacheTable.end(), -1);
+}
+
+void invalidateCache(uint32_t sector) {
+    std::lock_guard<pros::Mutex> lock(cacheMutex);
+    markStale(sector);
+    for (size_t i = 0; i < slots.size(); i++)
+        if (slots[i].used && slots[i].sector == sector) evictSlot(i);
+}
+
+size_t readCached(const FileStorage& storage, size_t offset, char* data, size_t size) {
+    std::unique_lock<pros::Mutex> lock(cacheMutex);
+    size_t total = 0;
+    // holds a block read to serve part of it
+    char partial[CACHE_BLOCK_SIZE];
+    while (size > 0) {
+        // the cache may have been disabled while a miss was read
+        if (slots.empty()) {
+            lock.unlock();
+            return total + readUncached(storage, offset, data, size);
+        }
+        const uint32_t block = offset / CACHE_BLOCK_SIZE;
+        const size_t start = offset % CACHE_BLOCK_SIZE;
+        const size_t n = std::min(size, CACHE_BLOCK_SIZE - start);
+        const int32_t found = cacheTable[findTableSlot(storage.sector, block)];
+        // a block cached at the end of the file may have been shorter than what is read now
+        if (found != -1 && slots[found].length >= start + n) {
+            memcpy(data, blocks.data() + found * CACHE_BLOCK_SIZE + start, n);
+            slots[found].referenced = true;
+            hits++;
+            total += n;
+            offset += n;
+            data += n;
+            size -= n;
+            continue;
+        }
+        // read a run of missing whole blocks straight into the caller's buffer with a single call, or else the whole
+        // block to serve the part that was asked for
+        const bool whole = start == 0 && n == CACHE_BLOCK_SIZE;
+        size_t run = 1;
+        while (whole && (run + 1) * CACHE_BLOCK_SIZE <= size &&
+               cacheTable[findTableSlot(storage.sector, block + run)] == -1)
+            run++;
+        char* target = whole ? data : partial;
+        InflightRead inflight;
+        const size_t read =
+            readUnlocked(lock, inflight, storage, size_t(block) * CACHE_BLOCK_SIZE, target, run * CACHE_BLOCK_SIZE);
+        misses += run;
+        // a write to the file while it was read may have made the blocks read older than the cache
+        if (!inflight.stale && !slots.empty()) cacheBlocks(storage.sector, block, target, read, true);
+        if (whole) {
+            total += read;
+            if (read < run * CACHE_BLOCK_SIZE) break;
+            offset += read;
+            data += read;
+            size -= read;
+            continue;
+        }
+        if (read <= start) break;
+        const size_t copied = std::min(n, read - start);
+        memcpy(data, partial + start, copied);
+        total += copied;
+        if (copied < n) break;
+        offset += n;
+        data += n;
+        size -= n;
+    }
+    return total;
+}
+
+void prefetchBlocks(const FileStorage& storage, size_t offset, size_t size, std::vector<char>& staging) {
+    uint32_t block = offset / CACHE_BLOCK_SIZE;
+    const uint32_t end = (offset + size + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE;
+    std::unique_lock<pros::Mutex> lock(cacheMutex);
+    while (block < end) {
+        if (slots.empty()) return;
+        // find the next run of missing blocks
+        while (block < end && cacheTable[findTableSlot(storage.sector, block)] != -1) block++;
+        uint32_t runEnd = block;
+        while (runEnd < end && cacheTable[findTableSlot(storage.sector, runEnd)] == -1) runEnd++;
+        if (block == end) return;
+        // the staging buffer is only used by the read-ahead task
+        staging.resize(size_t(runEnd - block) * CACHE_BLOCK_SIZE);
+        InflightRead inflight;
+        const size_t read =
+            readUnlocked(lock, inflight, storage, size_t(block) * CACHE_BLOCK_SIZE, staging.data(), staging.size());
+        // the blocks read may be older than a write that already updated the cache
+        if (inflight.stale || slots.empty()) return;
+        cacheBlocks(storage.sector, block, staging.data(), read, false);
+        if (read < staging.size()) return;
+        block = runEnd;
+    }
+}
+
+void updateCache(uint32_t sector, size_t offset, const char* data, size_t size) {
+    std::lock_guard<pros::Mutex> lock(cacheMutex);
+    markStale(sector);
+    if (slots.empty()) return;
+    while (size > 0) {
+        const uint32_t block = offset / CACHE_BLOCK_SIZE;
+        const size_t start = offset % CACHE_BLOCK_SIZE;
+        const size_t n = std::min(size, CACHE_BLOCK_SIZE - start);
+        const int32_t found = cacheTable[findTableSlot(sector, block)];
+        if (found != -1) {
+            CacheSlot& slot = slots[found];
+            // a write past the cached bytes leaves a gap the cache knows nothing about
+            if (start <= slot.length) {
+                memcpy(blocks.data() + found * CACHE_BLOCK_SIZE + start, data, n);
+                slot.length = static_cast<uint16_t>(std::max<size_t>(slot.length, start + n));
+            } else {
+                evictSlot(found);
+            }
+        }
+        offset += n;
+        data += n;
+        size -= n;
+    }
+}
+
+CacheStats getCacheStats() {
+    std::lock_guard<pros::Mutex> lock(cacheMutex);
+    return {hits, misses, slots.size() * CACHE_BLOCK_SIZE};
+}
+
+void resetCacheStats() {
+    std::lock_guard<pros::Mutex> lock(cacheMutex);
+    hits = 0;
+    misses = 0;
+}
+} // namespace fs
+} // namespace lemlib
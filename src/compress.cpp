@@ -0,0 +1,147 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       compress.cpp                                              */
+/*    Author:       LemLib Team                                               */
+/*    Description:  LZ4 block compression of the frames of compressed files   */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "vfs_internal.hpp"
+#include <string.h>
+
+namespace lemlib {
+namespace fs {
+/**
+ * @brief Parameters of the LZ4 block format
+ *
+ * Matches are at least MIN_MATCH bytes long. The last LAST_LITERALS bytes of a frame are always literals, and no match
+ * starts in the last MATCH_LIMIT bytes, so the decoder never has to check for the end of a match it is copying.
+ */
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5;
+constexpr size_t MATCH_LIMIT = 12;
+// the hash table of the compressor holds 2^HASH_BITS positions of 16 bits, 2 KiB of stack
+constexpr size_t HASH_BITS = 10;
+
+static_assert(COMPRESSED_FRAME_SIZE <= 0xFFFF, "positions in a frame must fit in the hash table");
+
+/**
+ * @brief Hash the 4 bytes at a position
+ *
+ */
+static uint32_t hashSequence(const char* data) {
+    uint32_t sequence;
+    memcpy(&sequence, data, sizeof(sequence));
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * @brief Write a length that did not fit in its half of the token
+ *
+ * @return char* the end of the length, or nullptr if it does not fit
+ */
+static char* writeLength(char* out, const char* end, size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (out == end) return nullptr;
+        *out++ = static_cast<char>(255);
+    }
+    if (out == end) return nullptr;
+    *out++ = static_cast<char>(length);
+    return out;
+}
+
+/**
+ * @brief Write a sequence of literals followed by a match
+ *
+ * @param matchLength the length of the match, or 0 for the literals at the end of the frame
+ * @return char* the end of the sequence, or nullptr if it does not fit
+ */
+static char* writeSequence(char* out, const char* end, const char* literals, size_t literalLength, size_t offset,
+                           size_t matchLength) {
+    if (out == end) return nullptr;
+    char* token = out++;
+    const size_t matchCode = (matchLength > 0) ? matchLength - MIN_MATCH : 0;
+    *token = static_cast<char>(((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+    if (literalLength >= 15 && (out = writeLength(out, end, literalLength - 15)) == nullptr) return nullptr;
+    if (size_t(end - out) < literalLength) return nullptr;
+    memcpy(out, literals, literalLength);
+    out += literalLength;
+    if (matchLength == 0) return out;
+    if (end - out < 2) return nullptr;
+    *out++ = static_cast<char>(offset & 0xFF);
+    *out++ = static_cast<char>(offset >> 8);
+    if (matchCode >= 15 && (out = writeLength(out, end, matchCode - 15)) == nullptr) return nullptr;
+    return out;
+}
+
+size_t compressFrame(const char* data, size_t size, char* out) {
+    if (size == 0) return 0;
+    uint16_t table[1 << HASH_BITS] = {};
+    // give up as soon as the output is not smaller than the input
+    const char* end = out + size - 1;
+    char* op = out;
+    size_t anchor = 0;
+    size_t ip = 0;
+    // greedy parsing, taking the first match the hash table finds
+    while (size >= MATCH_LIMIT && ip < size - MATCH_LIMIT) {
+        const uint32_t hash = hashSequence(data + ip);
+        const size_t candidate = table[hash];
+        table[hash] = static_cast<uint16_t>(ip);
+        if (candidate >= ip || memcmp(data + candidate, data + ip, MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+        size_t length = MIN_MATCH;
+        while (ip + length < size - LAST_LITERALS && data[candidate + length] == data[ip + length]) length++;
+        op = writeSequence(op, end, data + anchor, ip - anchor, ip - candidate, length);
+        if (op == nullptr) return 0;
+        ip += length;
+        anchor = ip;
+    }
+    op = writeSequence(op, end, data + anchor, size - anchor, 0, 0);
+    return (op == nullptr) ? 0 : size_t(op - out);
+}
+
+bool decompressFrame(const char* data, size_t size, char* out, size_t rawSize) {
+    const char* ip = data;
+    const char* const ipEnd = data + size;
+    size_t op = 0;
+    while (ip < ipEnd) {
+        const uint8_t token = static_cast<uint8_t>(*ip++);
+        // literals
+        size_t length = token >> 4;
+        if (length == 15) {
+            uint8_t extra;
+            do {
+                if (ip == ipEnd) return false;
+                extra = static_cast<uint8_t>(*ip++);
+                length += extra;
+            } while (extra == 255);
+        }
+        if (size_t(ipEnd - ip) < length || rawSize - op < length) return false;
+        memcpy(out + op, ip, length);
+        ip += length;
+        op += length;
+        // the last sequence has no match
+        if (ip == ipEnd) break;
+        if (ipEnd - ip < 2) return false;
+        const size_t offset = static_cast<uint8_t>(ip[0]) | (static_cast<uint8_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return false;
+        length = token & 15;
+        if (length == 15) {
+            uint8_t extra;
+            do {
+                if (ip == ipEnd) return false;
+                extra = static_cast<uint8_t>(*ip++);
+                length += extra;
+            } while (extra == 255);
+        }
+        length += MIN_MATCH;
+        if (rawSize - op < length) return false;
+        // byte by byte, since the match may overlap the bytes it produces
+        for (size_t i = 0; i < length; i++, op++) out[op] = out[op - offset];
+    }
+    return op == rawSize;
+}
+} // namespace fs
+} // namespace lemlib
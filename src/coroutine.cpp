@@ -0,0 +1,172 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       coroutine.cpp                                             */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Cooperative scheduler for coroutines awaiting VFS I/O     */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "lemlib/vfs_coroutine.hpp"
+#include "vfs_internal.hpp"
+#include <mutex>
+#include <new>
+
+namespace lemlib {
+namespace fs {
+// frames are rounded up to a power of 2 from 64 bytes, larger frames come from the heap
+static constexpr size_t MIN_FRAME_SIZE = 64;
+static constexpr size_t FRAME_CLASSES = 6;
+
+static std::atomic<bool> framePoolEnabled = true;
+static pros::Mutex frameMutex;
+// a free frame holds the next free frame of its size class
+static void* freeFrames[FRAME_CLASSES] = {};
+
+/**
+ * @brief Get the size class of a frame
+ *
+ * @return size_t the index of the class, FRAME_CLASSES if the frame is too large to be pooled
+ */
+static size_t frameClass(size_t size) {
+    size_t index = 0;
+    while (index < FRAME_CLASSES && (MIN_FRAME_SIZE << index) < size) index++;
+    return index;
+}
+
+void* Coroutine::promise_type::operator new(size_t size) {
+    const size_t index = frameClass(size);
+    if (index == FRAME_CLASSES) return ::operator new(size);
+    // frames are rounded up even without the pool, so any frame fits its class once the pool is enabled
+    if (!framePoolEnabled.load(std::memory_order_relaxed)) return ::operator new(MIN_FRAME_SIZE << index);
+    std::lock_guard<pros::Mutex> lock(frameMutex);
+    void* frame = freeFrames[index];
+    if (frame == nullptr) return ::operator new(MIN_FRAME_SIZE << index);
+    freeFrames[index] = *static_cast<void**>(frame);
+    return frame;
+}
+
+void Coroutine::promise_type::operator delete(void* frame, size_t size) {
+    const size_t index = frameClass(size);
+    if (index == FRAME_CLASSES || !framePoolEnabled.load(std::memory_order_relaxed)) return ::operator delete(frame);
+    // pooled frames are only given back to the heap when the pool is disabled, which may happen before the lock
+    std::lock_guard<pros::Mutex> lock(frameMutex);
+    if (!framePoolEnabled.load(std::memory_order_relaxed)) return ::operator delete(frame);
+    *static_cast<void**>(frame) = freeFrames[index];
+    freeFrames[index] = frame;
+}
+
+void setCoroutineFramePool(bool enabled) {
+    std::lock_guard<pros::Mutex> lock(frameMutex);
+    framePoolEnabled.store(enabled, std::memory_order_relaxed);
+    if (enabled) return;
+    for (void*& frame : freeFrames) {
+        while (frame != nullptr) {
+            void* next = *static_cast<void**>(frame);
+            ::operator delete(frame);
+            frame = next;
+        }
+    }
+}
+
+bool getCoroutineFramePool() { return framePoolEnabled.load(std::memory_order_relaxed); }
+
+Coroutine::Coroutine(std::coroutine_handle<promise_type> handle)
+    : m_handle(handle) {}
+
+Coroutine::Coroutine(Coroutine&& other) noexcept
+    : m_handle(other.m_handle) {
+    other.m_handle = nullptr;
+}
+
+Coroutine& Coroutine::operator=(Coroutine&& other) noexcept {
+    if (this != &other) {
+        if (m_handle) m_handle.destroy();
+        m_handle = other.m_handle;
+        other.m_handle = nullptr;
+    }
+    return *this;
+}
+
+Coroutine::~Coroutine() {
+    if (m_handle) m_handle.destroy();
+}
+
+void CoroutineScheduler::Delay::await_suspend(std::coroutine_handle<Coroutine::promise_type> handle) const {
+    handle.promise().scheduler->m_waiting.push_back({handle, nullptr, pros::millis() + milliseconds});
+}
+
+void CoroutineScheduler::Completion::await_suspend(std::coroutine_handle<Coroutine::promise_type> handle) const {
+    handle.promise().scheduler->m_waiting.push_back({handle, &result, 0});
+}
+
+CoroutineScheduler::CoroutineScheduler(uint32_t priority)
+    : m_task([this] { run(); }, priority, TASK_STACK_DEPTH_DEFAULT, "VFS coroutines") {}
+
+CoroutineScheduler::~CoroutineScheduler() {
+    m_stop.store(true);
+    m_task.notify();
+    while (!m_stopped.load()) pros::delay(1);
+}
+
+void CoroutineScheduler::spawn(Coroutine coroutine) {
+    coroutine.m_handle.promise().scheduler = this;
+    m_running++;
+    m_spawnMutex.take();
+    m_spawned.push_back(coroutine.m_handle);
+    m_spawnMutex.give();
+    // the scheduler owns the coroutine from now on
+    coroutine.m_handle = nullptr;
+    m_task.notify();
+}
+
+size_t CoroutineScheduler::running() const { return m_running.load(); }
+
+size_t CoroutineScheduler::failures() const { return m_failures.load(); }
+
+void CoroutineScheduler::resume(std::coroutine_handle<Coroutine::promise_type> handle) {
+    handle.resume();
+    if (!handle.done()) return;
+    if (handle.promise().failed) m_failures++;
+    handle.destroy();
+    m_running--;
+}
+
+void CoroutineScheduler::run() {
+    while (!m_stop.load()) {
+        m_spawnMutex.take();
+        m_ready.insert(m_ready.end(), m_spawned.begin(), m_spawned.end());
+        m_spawned.clear();
+        m_spawnMutex.give();
+        // wake the coroutines whose operation completed or whose delay ended, and find when the next delay ends
+        const uint32_t now = pros::millis();
+        uint32_t timeout = TIMEOUT_MAX;
+        size_t kept = 0;
+        for (const Waiting& waiting : m_waiting) {
+            const int32_t remaining = static_cast<int32_t>(waiting.wake - now);
+            if (waiting.result != nullptr ? waiting.result->ready() : remaining <= 0) {
+                m_ready.push_back(waiting.handle);
+            } else {
+                if (waiting.result == nullptr && static_cast<uint32_t>(remaining) < timeout) timeout = remaining;
+                m_waiting[kept++] = waiting;
+            }
+        }
+        m_waiting.resize(kept);
+        if (m_ready.empty()) {
+            // completed operations and spawn() notify the task
+            pros::Task::notify_take(true, timeout);
+            continue;
+        }
+        // coroutines that become ready while these run wait for the next round, so a delay of 0 yields
+        m_resuming.swap(m_ready);
+        for (auto handle : m_resuming) resume(handle);
+        m_resuming.clear();
+    }
+    // destroying a coroutine waits for the operation it is waiting on, so none of them completes later
+    m_spawnMutex.take();
+    for (auto handle : m_spawned) handle.destroy();
+    m_spawnMutex.give();
+    for (auto handle : m_ready) handle.destroy();
+    for (const Waiting& waiting : m_waiting) waiting.handle.destroy();
+    m_stopped.store(true);
+}
+} // namespace fs
+} // namespace lemlib
@@ -0,0 +1,508 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       file.cpp                                                  */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Buffered handles to virtual files                         */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "lemlib/vfs.hpp"
+#include "vfs_internal.hpp"
+#include "pros/rtos.hpp"
+#include <algorithm>
+#include <mutex>
+#include <string.h>
+
+namespace lemlib {
+namespace fs {
+// reads ahead need at least this many sequential reads in a row
+static constexpr size_t SEQUENTIAL_READS = 2;
+
+/**
+ * @brief Header of a frame of a compressed file
+ *
+ * A compressed file is a sequence of frames, each holding up to COMPRESSED_FRAME_SIZE bytes of data compressed on
+ * their own, so the frames can be decompressed one at a time with a fixed amount of memory. Data that does not compress
+ * is stored as is, with a stored size equal to its raw size. The checksum covers the header (with the checksum set to
+ * 0) and the stored data, so a frame torn by a brown out is detected when it is read.
+ *
+ * @param rawSize the size of the data
+ * @param storedSize the size of the data as stored after the header
+ * @param checksum the checksum of the frame
+ */
+struct FrameHeader {
+        uint16_t rawSize;
+        uint16_t storedSize;
+        uint32_t checksum;
+};
+
+static_assert(sizeof(FrameHeader) == 8, "frame header must not contain padding");
+
+/**
+ * @brief Compute the checksum of a frame
+ *
+ * @param header the header of the frame
+ * @param data the stored data of the frame
+ * @return uint32_t the checksum
+ */
+static uint32_t frameChecksum(const FrameHeader& header, const char* data) {
+    FrameHeader copy = header;
+    copy.checksum = 0;
+    return crc32(data, header.storedSize, crc32(&copy, sizeof(copy)));
+}
+
+// defined here, where the write-behind state it may destroy is a complete type
+File::File() = default;
+
+File::File(std::string_view path, Mode mode, size_t bufferSize) { open(path, mode, bufferSize); }
+
+File::File(File&& other) noexcept { *this = std::move(other); }
+
+File& File::operator=(File&& other) noexcept {
+    if (this == &other) return *this;
+    try {
+        close();
+    } catch (const VFSException&) {}
+    // the flush and read-ahead tasks hold a pointer to the stream while writes or reads are queued
+    if (other.m_writeBehind) other.m_writeBehind->failed = !other.waitForWriteBehind();
+    cancelReadAhead(&other.m_stream);
+    m_path = std::move(other.m_path);
+    m_openedPath = std::move(other.m_openedPath);
+    m_stream = std::move(other.m_stream);
+    m_mode = other.m_mode;
+    m_open = other.m_open;
+    m_buffer = std::move(other.m_buffer);
+    m_bufferStart = other.m_bufferStart;
+    m_bufferLength = other.m_bufferLength;
+    m_bufferDirty = other.m_bufferDirty;
+    m_position = other.m_position;
+    m_size = other.m_size;
+    m_sector = other.m_sector;
+    m_container = other.m_container;
+    m_inline = other.m_inline;
+    m_reserved = other.m_reserved;
+    m_writeBehind = std::move(other.m_writeBehind);
+    if (m_writeBehind) m_writeBehind->storage = storage();
+    m_readAhead = other.m_readAhead;
+    m_lastReadEnd = other.m_lastReadEnd;
+    m_sequentialReads = other.m_sequentialReads;
+    m_prefetchedTo = other.m_prefetchedTo;
+    m_compressed = other.m_compressed;
+    m_storedEnd = other.m_storedEnd;
+    m_frameRaw = other.m_frameRaw;
+    m_frameStored = other.m_frameStored;
+    m_frame = std::move(other.m_frame);
+    other.m_open = false;
+    other.m_bufferDirty = false;
+    return *this;
+}
+
+File::~File() {
+    try {
+        close();
+    } catch (const VFSException&) {}
+}
+
+void File::open(std::string_view path, Mode mode, size_t bufferSize) {
+    close();
+    // resolve the sector once, creating the file if it is opened for writing
+    uint32_t sector;
+    if (!lookupFileSector(path, sector)) {
+        if (mode == Mode::READ) throw FILE_NOT_FOUND(std::string(path));
+        sector = findOrCreateFile(path);
+    }
+    m_path = getSectorPath(sector);
+    m_openedPath = normalizePath(path);
+    m_sector = sector;
+    m_container = getContainerLength(sector, m_size);
+    m_inline = getInlineLength(sector, m_size);
+    m_reserved = getReservedLength(sector, m_size);
+    m_compressed = isCompressedFile(path);
+    if (mode == Mode::WRITE) invalidateCache(sector);
+    // the buffer of the handle replaces the buffer of the stream
+    m_stream.rdbuf()->pubsetbuf(nullptr, 0);
+    const std::ios_base::openmode binary = std::ios_base::binary;
+    if (m_container || m_inline) {
+        // container and inline files are accessed through the shared containers and the resident index
+        if (mode == Mode::WRITE && m_container) truncateContainer(sector);
+        if (mode == Mode::WRITE && m_inline) truncateInline(sector);
+        if (mode == Mode::WRITE) m_size = 0;
+    } else if (mode == Mode::READ) {
+        // a sector file that was never written to reads as an empty file
+        m_stream.open(m_path, std::ios_base::in | binary);
+    } else if (mode == Mode::WRITE && !m_reserved) {
+        m_stream.open(m_path, std::ios_base::in | std::ios_base::out | std::ios_base::trunc | binary);
+    } else {
+        // emptying a reserved file only resets its length, so its space stays allocated
+        if (mode == Mode::WRITE) truncateReserved(sector);
+        // create the sector file first if it does not exist, without emptying it if it does
+        std::ofstream(m_path, std::ios_base::app | binary);
+        m_stream.open(m_path, std::ios_base::in | std::ios_base::out | binary);
+    }
+    const bool sectorFile = !m_container && !m_inline;
+    if (sectorFile && !m_stream.is_open() && mode != Mode::READ) throw CANNOT_OPEN_FILE(m_path);
+    if (sectorFile) m_size = storedSize();
+    m_mode = mode;
+    m_open = true;
+    // a compressed file is read and written a frame at a time
+    m_buffer.resize(m_compressed ? COMPRESSED_FRAME_SIZE : bufferSize);
+    m_bufferStart = 0;
+    m_bufferLength = 0;
+    m_bufferDirty = false;
+    m_storedEnd = m_size;
+    m_frameRaw = 0;
+    m_frameStored = 0;
+    if (m_compressed) {
+        m_frame.resize(sizeof(FrameHeader) + COMPRESSED_FRAME_SIZE);
+        // the size of the data is the sum of the sizes in the headers, and writes go after the last intact frame
+        size_t rawSize, storedSize;
+        while (readFrameHeader(rawSize, storedSize)) {
+            m_frameRaw += rawSize;
+            m_frameStored += storedSize;
+        }
+        m_size = m_frameRaw;
+        m_storedEnd = m_frameStored;
+        m_frameRaw = 0;
+        m_frameStored = 0;
+    }
+    m_position = (mode == Mode::APPEND) ? m_size : 0;
+    m_readAhead = DEFAULT_READ_AHEAD;
+    m_lastReadEnd = 0;
+    m_sequentialReads = 0;
+    m_prefetchedTo = 0;
+}
+
+bool File::isOpen() const { return m_open; }
+
+size_t File::read(void* data, size_t size) {
+    if (!m_open) throw FILE_NOT_OPEN;
+    if (m_bufferDirty) flushBuffer();
+    if (m_writeBehind) {
+        if (!waitForWriteBehind()) throw CANNOT_WRITE_FILE(m_path);
+        // queued writes may have been discarded, so the size is only known once they are done
+        m_size = storedSize();
+    }
+    if (m_position == m_lastReadEnd) {
+        m_sequentialReads++;
+    } else {
+        m_sequentialReads = 0;
+        m_prefetchedTo = 0;
+    }
+    char* out = static_cast<char*>(data);
+    size_t total = 0;
+    while (size > 0) {
+        // copy from the buffer if it holds the current position
+        if (m_position >= m_bufferStart && m_position < m_bufferStart + m_bufferLength) {
+            const size_t n = std::min(size, m_bufferStart + m_bufferLength - m_position);
+            memcpy(out, m_buffer.data() + (m_position - m_bufferStart), n);
+            out += n;
+            size -= n;
+            total += n;
+            m_position += n;
+            continue;
+        }
+        if (m_position >= m_size) break;
+        if (m_compressed) {
+            loadFrame(m_position);
+            continue;
+        }
+        // large reads skip the buffer, small reads fill it
+        if (size >= m_buffer.size()) {
+            const size_t n = readStorage(storage(), m_position, out, std::min(size, m_size - m_position));
+            if (n == 0) throw CANNOT_READ_FILE(m_path);
+            total += n;
+            m_position += n;
+            break;
+        }
+        m_bufferStart = m_position;
+        m_bufferLength =
+            readStorage(storage(), m_position, m_buffer.data(), std::min(m_buffer.size(), m_size - m_position));
+        if (m_bufferLength == 0) throw CANNOT_READ_FILE(m_path);
+    }
+    m_lastReadEnd = m_position;
+    readAhead();
+    return total;
+}
+
+void File::write(const void* data, size_t size) {
+    if (!m_open) throw FILE_NOT_OPEN;
+    if (m_mode == Mode::READ) throw CANNOT_WRITE_FILE(m_path);
+    if (m_mode == Mode::APPEND) m_position = this->size();
+    if (m_compressed) {
+        // frames can only be added after the last one
+        if (m_position != this->size()) throw CANNOT_WRITE_FILE(m_path);
+        if (!m_bufferDirty) m_bufferLength = 0;
+        const char* in = static_cast<const char*>(data);
+        while (size > 0) {
+            if (m_bufferLength == 0) m_bufferStart = m_position;
+            const size_t n = std::min(size, m_buffer.size() - m_bufferLength);
+            memcpy(m_buffer.data() + m_bufferLength, in, n);
+            m_bufferLength += n;
+            m_bufferDirty = true;
+            m_position += n;
+            in += n;
+            size -= n;
+            if (m_bufferLength == m_buffer.size()) flushBuffer();
+        }
+        return;
+    }
+    // drop data that was read into the buffer, and write out the buffer if this write does not continue it
+    if (!m_bufferDirty) m_bufferLength = 0;
+    else if (m_position != m_bufferStart + m_bufferLength) flushBuffer();
+    if (m_bufferLength + size > m_buffer.size()) flushBuffer();
+    // large writes skip the buffer
+    if (size >= m_buffer.size()) promoteIfNeeded(m_position + size);
+    if (size >= m_buffer.size() && m_writeBehind) {
+        queueWrite(*m_writeBehind, m_position, static_cast<const char*>(data), size);
+        m_position += size;
+        m_size = std::max(m_size, m_position);
+        return;
+    }
+    if (size >= m_buffer.size()) {
+        if (!writeStorage(storage(), m_position, static_cast<const char*>(data), size))
+            throw CANNOT_WRITE_FILE(m_path);
+        m_position += size;
+        m_size = std::max(m_size, m_position);
+        return;
+    }
+    if (m_bufferLength == 0) m_bufferStart = m_position;
+    memcpy(m_buffer.data() + m_bufferLength, data, size);
+    m_bufferLength += size;
+    m_bufferDirty = true;
+    m_position += size;
+}
+
+void File::write(std::string_view data) { write(data.data(), data.size()); }
+
+void File::seek(size_t position) {
+    if (!m_open) throw FILE_NOT_OPEN;
+    if (m_bufferDirty && position != m_bufferStart + m_bufferLength) flushBuffer();
+    m_position = position;
+}
+
+size_t File::tell() const { return m_position; }
+
+size_t File::size() const { return m_bufferDirty ? std::max(m_size, m_bufferStart + m_bufferLength) : m_size; }
+
+void File::flush() {
+    if (!m_open) throw FILE_NOT_OPEN;
+    flushBuffer();
+    if (m_writeBehind && !waitForWriteBehind()) throw CANNOT_WRITE_FILE(m_path);
+    if (m_container) {
+        commitContainer(m_sector);
+        return;
+    }
+    if (m_inline) {
+        commitInline(m_sector);
+        return;
+    }
+    {
+        std::lock_guard<pros::Mutex> lock(m_streamMutex);
+        m_stream.flush();
+        if (!m_stream) throw CANNOT_WRITE_FILE(m_path);
+    }
+    // the length is recorded once the data it covers is on the SD card
+    if (m_reserved) commitReserved(m_sector);
+}
+
+void File::setWriteBehind(bool enabled) {
+    if (!m_open) throw FILE_NOT_OPEN;
+    // files opened for reading are never written to
+    if (m_mode == Mode::READ || m_compressed || enabled == static_cast<bool>(m_writeBehind)) return;
+    flushBuffer();
+    if (enabled) {
+        m_writeBehind = std::make_unique<WriteBehindTarget>();
+        m_writeBehind->storage = storage();
+    } else {
+        const bool succeeded = waitForWriteBehind();
+        m_writeBehind.reset();
+        if (!succeeded) throw CANNOT_WRITE_FILE(m_path);
+    }
+}
+
+void File::setReadAhead(size_t bytes) {
+    if (!m_open) throw FILE_NOT_OPEN;
+    m_readAhead = bytes;
+}
+
+void File::close() {
+    if (!m_open) return;
+    m_open = false;
+    // close the stream even if the last write fails, but not before the flush task is done with it
+    bool succeeded = true;
+    try {
+        flushBuffer();
+    } catch (const VFSException&) {
+        succeeded = false;
+    }
+    if (m_writeBehind) {
+        succeeded = waitForWriteBehind() && succeeded;
+        m_writeBehind.reset();
+    }
+    cancelReadAhead(&m_stream);
+    m_stream.close();
+    if (!succeeded) throw CANNOT_WRITE_FILE(m_path);
+    if (m_container && m_mode != Mode::READ) commitContainer(m_sector);
+    if (m_inline && m_mode != Mode::READ) commitInline(m_sector);
+    if (m_reserved && m_mode != Mode::READ) commitReserved(m_sector);
+}
+
+void File::flushBuffer() {
+    if (m_bufferDirty && !m_compressed) promoteIfNeeded(m_bufferStart + m_bufferLength);
+    if (m_bufferDirty && m_writeBehind) {
+        m_bufferDirty = false;
+        queueWrite(*m_writeBehind, m_bufferStart, m_buffer.data(), m_bufferLength);
+        m_size = std::max(m_size, m_bufferStart + m_bufferLength);
+    } else if (m_bufferDirty && m_compressed) {
+        m_bufferDirty = false;
+        // compress the buffer into a frame after the last one, and write it with a single call
+        char* data = m_frame.data() + sizeof(FrameHeader);
+        size_t dataSize = compressFrame(m_buffer.data(), m_bufferLength, data);
+        if (dataSize == 0) {
+            memcpy(data, m_buffer.data(), m_bufferLength);
+            dataSize = m_bufferLength;
+        }
+        FrameHeader header = {static_cast<uint16_t>(m_bufferLength), static_cast<uint16_t>(dataSize), 0};
+        header.checksum = frameChecksum(header, data);
+        memcpy(m_frame.data(), &header, sizeof(header));
+        if (!writeStorage(storage(), m_storedEnd, m_frame.data(), sizeof(header) + dataSize)) {
+            m_bufferLength = 0;
+            throw CANNOT_WRITE_FILE(m_path);
+        }
+        m_storedEnd += sizeof(header) + dataSize;
+        m_size = std::max(m_size, m_bufferStart + m_bufferLength);
+    } else if (m_bufferDirty) {
+        m_bufferDirty = false;
+        if (!writeStorage(storage(), m_bufferStart, m_buffer.data(), m_bufferLength)) {
+            m_bufferLength = 0;
+            throw CANNOT_WRITE_FILE(m_path);
+        }
+        m_size = std::max(m_size, m_bufferStart + m_bufferLength);
+    }
+    m_bufferLength = 0;
+}
+
+bool File::waitForWriteBehind() { return waitForWrites(*m_writeBehind); }
+
+FileStorage File::storage() { return {&m_stream, &m_streamMutex, m_sector, m_container, m_inline, m_reserved}; }
+
+size_t File::storedSize() {
+    size_t size = 0;
+    if (m_container) {
+        getContainerLength(m_sector, size);
+    } else if (m_inline) {
+        getInlineLength(m_sector, size);
+    } else if (m_reserved) {
+        getReservedLength(m_sector, size);
+    } else if (m_stream.is_open()) {
+        std::lock_guard<pros::Mutex> lock(m_streamMutex);
+        m_stream.clear();
+        m_stream.seekg(0, std::ios_base::end);
+        size = static_cast<size_t>(m_stream.tellg());
+    }
+    return size;
+}
+
+void File::promoteIfNeeded(size_t end) {
+    if (!m_inline || end <= getInlineThreshold()) return;
+    // queued writes still go to the inline file
+    if (m_writeBehind && !waitForWriteBehind()) throw CANNOT_WRITE_FILE(m_path);
+    cancelReadAhead(&m_stream);
+    promoteInlineFile(m_sector);
+    m_inline = false;
+    m_stream.open(m_path, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+    if (!m_stream.is_open()) throw CANNOT_OPEN_FILE(m_path);
+    if (m_writeBehind) m_writeBehind->storage = storage();
+}
+
+void File::readAhead() {
+    if (m_readAhead == 0 || m_sequentialReads < SEQUENTIAL_READS) return;
+    // the next read starts after the data already in the buffer, compressed files are prefetched by their frames
+    const size_t next = m_compressed ? m_frameStored : std::max(m_position, m_bufferStart + m_bufferLength);
+    const size_t end = std::min(m_compressed ? m_storedEnd : m_size, next + m_readAhead);
+    // prefetch again once half of the window has been read
+    if (m_prefetchedTo >= end || m_prefetchedTo >= next + m_readAhead / 2) return;
+    const size_t start = std::max(next, m_prefetchedTo);
+    requestReadAhead(storage(), start, end - start);
+    m_prefetchedTo = end;
+}
+
+void File::loadFrame(size_t position) {
+    // frames can only be found by walking their headers, from the start of the file if the position is behind
+    if (position < m_frameRaw) {
+        m_frameRaw = 0;
+        m_frameStored = 0;
+    }
+    size_t rawSize, storedSize;
+    while (true) {
+        if (!readFrameHeader(rawSize, storedSize)) throw CANNOT_READ_FILE(m_path);
+        if (position < m_frameRaw + rawSize) break;
+        m_frameRaw += rawSize;
+        m_frameStored += storedSize;
+    }
+    if (readStorage(storage(), m_frameStored, m_frame.data(), storedSize) != storedSize) throw CANNOT_READ_FILE(m_path);
+    FrameHeader header;
+    memcpy(&header, m_frame.data(), sizeof(header));
+    const char* data = m_frame.data() + sizeof(header);
+    if (frameChecksum(header, data) != header.checksum) throw CANNOT_READ_FILE(m_path);
+    if (header.storedSize == header.rawSize) memcpy(m_buffer.data(), data, rawSize);
+    else if (!decompressFrame(data, header.storedSize, m_buffer.data(), rawSize)) throw CANNOT_READ_FILE(m_path);
+    m_bufferStart = m_frameRaw;
+    m_bufferLength = rawSize;
+    // the next sequential read finds its frame right away
+    m_frameRaw += rawSize;
+    m_frameStored += storedSize;
+}
+
+bool File::readFrameHeader(size_t& rawSize, size_t& storedSize) {
+    FrameHeader header;
+    if (m_storedEnd - m_frameStored < sizeof(header) ||
+        readStorage(storage(), m_frameStored, reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header))
+        return false;
+    rawSize = header.rawSize;
+    storedSize = sizeof(header) + header.storedSize;
+    return rawSize > 0 && rawSize <= COMPRESSED_FRAME_SIZE && header.storedSize > 0 &&
+           header.storedSize <= rawSize && storedSize <= m_storedEnd - m_frameStored;
+}
+
+size_t readStorage(const FileStorage& storage, size_t offset, char* data, size_t size) {
+    return readCached(storage, offset, data, size);
+}
+
+bool writeStorage(const FileStorage& storage, size_t offset, const char* data, size_t size) {
+    // the reserved space of a sector file may hold old data, so a write past the end fills the gap with zeros
+    size_t length;
+    if (storage.reserved && size > 0 && getReservedLength(storage.sector, length)) {
+        static const char zeros[CACHE_BLOCK_SIZE] = {};
+        for (size_t n; length < offset; length += n) {
+            n = std::min(offset - length, sizeof(zeros));
+            if (!writeStorage(storage, length, zeros, n)) return false;
+        }
+    }
+    if (!writeUncached(storage, offset, data, size)) return false;
+    updateCache(storage.sector, offset, data, size);
+    return true;
+}
+
+size_t readUncached(const FileStorage& storage, size_t offset, char* data, size_t size) {
+    if (storage.container) return readContainer(storage.sector, offset, data, size);
+    if (storage.inlined) return readInline(storage.sector, offset, data, size);
+    std::lock_guard<pros::Mutex> lock(*storage.streamMutex);
+    storage.stream->clear();
+    storage.stream->seekg(offset);
+    storage.stream->read(data, size);
+    return static_cast<size_t>(storage.stream->gcount());
+}
+
+bool writeUncached(const FileStorage& storage, size_t offset, const char* data, size_t size) {
+    if (storage.container) return writeContainer(storage.sector, offset, data, size);
+    if (storage.inlined) return writeInline(storage.sector, offset, data, size);
+    std::lock_guard<pros::Mutex> lock(*storage.streamMutex);
+    storage.stream->clear();
+    storage.stream->seekp(offset);
+    storage.stream->write(data, size);
+    if (storage.stream->fail()) return false;
+    if (storage.reserved && size > 0) extendReserved(storage.sector, offset + size);
+    return true;
+}
+} // namespace fs
+} // namespace lemlib
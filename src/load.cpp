@@ -0,0 +1,75 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       load.cpp                                                  */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Whole virtual files loaded into RAM                       */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "lemlib/vfs.hpp"
+#include "vfs_internal.hpp"
+#include "pros/rtos.hpp"
+#include <map>
+#include <mutex>
+
+namespace lemlib {
+namespace fs {
+/**
+ * @brief Arena holding the contents of a loaded file
+ *
+ * @param data the contents of the file
+ * @param size the size of the file in bytes
+ */
+struct LoadedFile {
+        std::unique_ptr<char[]> data;
+        size_t size;
+};
+
+static std::map<std::string, LoadedFile, std::less<>> loadedFiles;
+static pros::Mutex loadMutex;
+
+/**
+ * @brief Read a whole file with a single call
+ *
+ * @param file the file, opened without a buffer
+ * @param path the path of the file, for errors
+ * @param arena where to store the contents of the file
+ * @param size the size of the file
+ */
+static void readWhole(File& file, std::string_view path, char* arena, size_t size) {
+    if (size > 0 && file.read(arena, size) != size) throw CANNOT_READ_FILE(std::string(path));
+}
+
+std::string_view load(std::string_view path) {
+    // without a buffer, the read goes straight to the arena
+    File file(path, Mode::READ, 0);
+    file.setReadAhead(0);
+    const size_t size = file.size();
+    // not zero-initialized, the read overwrites all of it
+    LoadedFile loaded = {std::unique_ptr<char[]>(new char[size]), size};
+    readWhole(file, path, loaded.data.get(), size);
+    // keyed like the index, so "cfg" and "/cfg" are the same file
+    std::string key = normalizePath(path);
+    std::lock_guard<pros::Mutex> lock(loadMutex);
+    auto it = loadedFiles.find(key);
+    if (it == loadedFiles.end()) it = loadedFiles.emplace(std::move(key), LoadedFile()).first;
+    it->second = std::move(loaded);
+    return {it->second.data.get(), it->second.size};
+}
+
+std::string_view load(std::string_view path, char* arena, size_t capacity) {
+    File file(path, Mode::READ, 0);
+    file.setReadAhead(0);
+    const size_t size = file.size();
+    if (size > capacity) throw FILE_TOO_LARGE(std::string(path));
+    readWhole(file, path, arena, size);
+    return {arena, size};
+}
+
+void unload(std::string_view path) {
+    const std::string key = normalizePath(path);
+    std::lock_guard<pros::Mutex> lock(loadMutex);
+    auto it = loadedFiles.find(key);
+    if (it != loadedFiles.end()) loadedFiles.erase(it);
+}
+} // namespace fs
+} // namespace lemlib
@@ -0,0 +1,86 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       logger.cpp                                                */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Binary record logger backed by a lock-free ring buffer    */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "lemlib/vfs.hpp"
+#include "vfs_internal.hpp"
+#include "pros/rtos.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace lemlib {
+namespace fs {
+Logger::Logger(std::string_view path, size_t recordSize, size_t capacity, uint32_t interval, uint32_t priority)
+    : m_file(path, Mode::APPEND),
+      m_recordSize(recordSize),
+      m_interval(interval) {
+    // a power of 2 lets the free running counters wrap around without skipping a slot
+    uint32_t slots = 1;
+    while (slots < capacity) slots *= 2;
+    m_mask = slots - 1;
+    m_records.resize(slots * recordSize);
+    pros::Task([this] { run(); }, priority, TASK_STACK_DEPTH_DEFAULT, "VFS logger");
+}
+
+Logger::~Logger() {
+    m_stop.store(true);
+    while (!m_stopped.load()) pros::delay(1);
+}
+
+bool Logger::log(const void* record) {
+    const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) > m_mask) {
+        m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+    }
+    memcpy(m_records.data() + (tail & m_mask) * m_recordSize, record, m_recordSize);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void Logger::flush() {
+    const uint32_t target = m_tail.load(std::memory_order_relaxed);
+    m_flushRequested.store(target);
+    while (static_cast<int32_t>(m_flushed.load() - target) < 0 && !m_stopped.load()) pros::delay(1);
+    if (m_failed.exchange(false)) throw CANNOT_WRITE_FILE("logger");
+}
+
+size_t Logger::dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+void Logger::run() {
+    uint32_t time = pros::millis();
+    while (!m_stop.load()) {
+        writeRecords();
+        pros::Task::delay_until(&time, m_interval);
+    }
+    writeRecords();
+    try {
+        m_file.close();
+    } catch (const VFSException&) {}
+    m_stopped.store(true);
+}
+
+void Logger::writeRecords() {
+    const uint32_t head = m_head.load(std::memory_order_relaxed);
+    const uint32_t tail = m_tail.load(std::memory_order_acquire);
+    const bool flushRequested = static_cast<int32_t>(m_flushRequested.load() - m_flushed.load()) > 0;
+    try {
+        // the records between head and tail are at most two runs, split where the ring wraps around
+        const uint32_t start = head & m_mask;
+        const uint32_t count = tail - head;
+        const uint32_t first = std::min(count, m_mask + 1 - start);
+        if (first > 0) m_file.write(m_records.data() + start * m_recordSize, first * m_recordSize);
+        if (count > first) m_file.write(m_records.data(), (count - first) * m_recordSize);
+        if (flushRequested) m_file.flush();
+    } catch (const VFSException&) {
+        m_failed.store(true);
+    }
+    // the records are consumed even if they could not be written, so the ring does not fill up
+    m_head.store(tail, std::memory_order_release);
+    if (flushRequested) m_flushed.store(tail);
+}
+} // namespace fs
+} // namespace lemlib
@@ -0,0 +1,102 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       readahead.cpp                                             */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Task prefetching sequentially read files into the cache   */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "lemlib/vfs.hpp"
+#include "vfs_internal.hpp"
+#include "pros/rtos.hpp"
+#include <optional>
+
+namespace lemlib {
+namespace fs {
+/**
+ * @brief Range of a file waiting to be prefetched
+ *
+ * @param storage the storage of the file, whose stream identifies the handle that asked for it
+ * @param offset the start of the range
+ * @param size the size of the range
+ */
+struct ReadAheadRequest {
+        FileStorage storage;
+        size_t offset;
+        size_t size;
+};
+
+// a handle has at most one queued request, so this is the number of handles that can stream at once
+static constexpr size_t MAX_REQUESTS = 8;
+
+static pros::Mutex requestMutex;
+static std::optional<pros::Task> readAheadTask;
+static ReadAheadRequest requests[MAX_REQUESTS];
+static size_t requestCount = 0;
+// the stream of the request the task is prefetching, if any
+static const std::fstream* activeStream = nullptr;
+// set while the handle of activeStream waits for the prefetch to end, which posts prefetchDone
+static bool cancelling = false;
+static pros::c::sem_t prefetchDone = pros::c::sem_binary_create();
+
+/**
+ * @brief Prefetch the queued requests, oldest first
+ *
+ */
+static void readAheadLoop() {
+    // reused for every request, so prefetching allocates only until it has seen the largest window
+    std::vector<char> staging;
+    while (true) {
+        requestMutex.take();
+        if (requestCount == 0) {
+            requestMutex.give();
+            pros::Task::notify_take(true, TIMEOUT_MAX);
+            continue;
+        }
+        const ReadAheadRequest request = requests[0];
+        for (size_t i = 1; i < requestCount; i++) requests[i - 1] = requests[i];
+        requestCount--;
+        activeStream = request.storage.stream;
+        requestMutex.give();
+
+        prefetchBlocks(request.storage, request.offset, request.size, staging);
+
+        requestMutex.take();
+        activeStream = nullptr;
+        if (cancelling) pros::c::sem_post(prefetchDone);
+        cancelling = false;
+        requestMutex.give();
+    }
+}
+
+void requestReadAhead(const FileStorage& storage, size_t offset, size_t size) {
+    // prefetched blocks have nowhere to go without a cache
+    if (size == 0 || getCacheStats().capacity == 0) return;
+    requestMutex.take();
+    if (!readAheadTask)
+        readAheadTask.emplace(readAheadLoop, TASK_PRIORITY_MIN, TASK_STACK_DEPTH_DEFAULT, "VFS read-ahead");
+    size_t i = 0;
+    while (i < requestCount && requests[i].storage.stream != storage.stream) i++;
+    if (i == MAX_REQUESTS) {
+        requestMutex.give();
+        return;
+    }
+    requests[i] = {storage, offset, size};
+    if (i == requestCount) requestCount++;
+    requestMutex.give();
+    readAheadTask->notify();
+}
+
+void cancelReadAhead(const std::fstream* stream) {
+    requestMutex.take();
+    size_t kept = 0;
+    for (size_t i = 0; i < requestCount; i++)
+        if (requests[i].storage.stream != stream) requests[kept++] = requests[i];
+    requestCount = kept;
+    // only the handle of a stream cancels its prefetch, so at most one task waits here
+    const bool active = activeStream == stream;
+    if (active) cancelling = true;
+    requestMutex.give();
+    if (active) pros::c::sem_wait(prefetchDone, TIMEOUT_MAX);
+}
+} // namespace fs
+} // namespace lemlib
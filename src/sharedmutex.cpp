@@ -0,0 +1,69 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       sharedmutex.cpp                                           */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Reader-writer lock for the resident index                 */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "vfs_internal.hpp"
+
+namespace lemlib {
+namespace fs {
+SharedMutex::SharedMutex()
+    : m_drained(pros::c::sem_binary_create()) {}
+
+SharedMutex::~SharedMutex() { pros::c::sem_delete(m_drained); }
+
+void SharedMutex::lock() {
+    const pros::task_t current = pros::c::task_get_current();
+    if (m_owner == current) {
+        m_depth++;
+        return;
+    }
+    m_turnstile.take();
+    m_owner = current;
+    m_depth = 1;
+    // a reader that left before m_owner was set may still give the semaphore, so it is only a hint to look again.
+    // Task notifications aren't used since they could take one that belongs to the task
+    while (m_readers != 0) pros::c::sem_wait(m_drained, TIMEOUT_MAX);
+}
+
+void SharedMutex::unlock() {
+    if (--m_depth > 0) return;
+    m_owner = nullptr;
+    m_turnstile.give();
+}
+
+void SharedMutex::lock_shared() {
+    const pros::task_t current = pros::c::task_get_current();
+    // the writer can read what it is changing
+    if (m_owner == current) {
+        m_depth++;
+        return;
+    }
+    while (true) {
+        // announce the reader first, so a writer that takes the lock now waits for it to leave
+        m_readers++;
+        if (m_owner == nullptr) return;
+        leave();
+        // wait for the writer, which inherits the priority of the reader meanwhile
+        m_turnstile.take();
+        m_turnstile.give();
+    }
+}
+
+void SharedMutex::unlock_shared() {
+    if (m_owner == pros::c::task_get_current()) {
+        m_depth--;
+        return;
+    }
+    leave();
+}
+
+void SharedMutex::leave() {
+    // m_readers is decremented before m_owner is read, and the writer sets m_owner before reading m_readers, so
+    // either the writer sees no readers or the last reader sees the writer
+    if (--m_readers == 0 && m_owner != nullptr) pros::c::sem_post(m_drained);
+}
+} // namespace fs
+} // namespace lemlib
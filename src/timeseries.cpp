@@ -0,0 +1,266 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       timeseries.cpp                                            */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Columnar delta encoding of numeric time series            */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "lemlib/vfs.hpp"
+#include "vfs_internal.hpp"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+namespace lemlib {
+namespace fs {
+/**
+ * @brief Header of a time series file
+ *
+ * Followed by the scale of each column as a float, then by the blocks.
+ *
+ * @param magic TIME_SERIES_MAGIC
+ * @param version TIME_SERIES_VERSION
+ * @param columns the number of values per sample
+ */
+struct TimeSeriesHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t columns;
+};
+
+/**
+ * @brief Header of a block of samples
+ *
+ * Followed by size bytes of varints: the timestamps, then each column of values. The checksum covers the header (with
+ * the checksum set to 0) and the varints.
+ *
+ * @param samples the number of samples in the block
+ * @param size the size of the varints in bytes
+ * @param checksum the checksum of the block
+ */
+struct TimeSeriesBlock {
+        uint32_t samples;
+        uint32_t size;
+        uint32_t checksum;
+};
+
+static_assert(sizeof(TimeSeriesHeader) == 8, "time series header must not contain padding");
+static_assert(sizeof(TimeSeriesBlock) == 12, "time series block header must not contain padding");
+
+constexpr uint32_t TIME_SERIES_MAGIC = 0x5354564C; // "LVTS"
+constexpr uint16_t TIME_SERIES_VERSION = 1;
+// the longest varint of a 64 bit number
+constexpr size_t MAX_VARINT_SIZE = 10;
+
+/**
+ * @brief Map a signed number to an unsigned one, so numbers close to 0 get short varints
+ *
+ */
+static uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+/**
+ * @brief Undo zigzag()
+ *
+ */
+static int64_t unzigzag(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+
+/**
+ * @brief Append a number as a varint, 7 bits per byte with the high bit set on all bytes but the last
+ *
+ */
+static void putVarint(std::vector<char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/**
+ * @brief Read a varint
+ *
+ * @param in the varint, moved past it
+ * @param end the end of the data
+ * @param value set to the number
+ * @return true the varint was read
+ * @return false the varint is truncated or too long
+ */
+static bool getVarint(const char*& in, const char* end, uint64_t& value) {
+    value = 0;
+    for (size_t i = 0; i < MAX_VARINT_SIZE && in != end; i++) {
+        const uint8_t byte = static_cast<uint8_t>(*in++);
+        value |= uint64_t(byte & 0x7F) << (7 * i);
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Compute the checksum of a block
+ *
+ * @param header the header of the block
+ * @param data the varints of the block
+ * @return uint32_t the checksum
+ */
+static uint32_t blockChecksum(const TimeSeriesBlock& header, const char* data) {
+    TimeSeriesBlock copy = header;
+    copy.checksum = 0;
+    return crc32(data, header.size, crc32(&copy, sizeof(copy)));
+}
+
+/**
+ * @brief Scale a value to an integer, saturating values out of range
+ *
+ */
+static int32_t quantize(float value, float scale) {
+    const double scaled = double(value) * scale;
+    if (std::isnan(scaled)) return 0;
+    return static_cast<int32_t>(std::lround(std::clamp<double>(scaled, INT32_MIN, INT32_MAX)));
+}
+
+TimeSeriesWriter::TimeSeriesWriter(std::string_view path, const std::vector<float>& scales, size_t blockSamples)
+    : m_file(path, Mode::WRITE),
+      m_scales(scales),
+      m_blockSamples(std::max<size_t>(blockSamples, 1)) {
+    const TimeSeriesHeader header = {TIME_SERIES_MAGIC, TIME_SERIES_VERSION, static_cast<uint16_t>(scales.size())};
+    m_file.write(&header, sizeof(header));
+    m_file.write(scales.data(), scales.size() * sizeof(float));
+    // allocate everything up front, so write() can be called from a control loop
+    m_timestamps.reserve(m_blockSamples);
+    m_values.reserve(m_blockSamples * scales.size());
+    m_block.reserve(sizeof(TimeSeriesBlock) + m_blockSamples * (scales.size() + 1) * MAX_VARINT_SIZE);
+}
+
+TimeSeriesWriter::~TimeSeriesWriter() {
+    try {
+        close();
+    } catch (const VFSException&) {}
+}
+
+void TimeSeriesWriter::write(uint32_t timestamp, const float* values) {
+    if (!m_file.isOpen()) throw FILE_NOT_OPEN;
+    m_timestamps.push_back(timestamp);
+    for (size_t i = 0; i < m_scales.size(); i++) m_values.push_back(quantize(values[i], m_scales[i]));
+    if (m_timestamps.size() == m_blockSamples) writeBlock();
+}
+
+void TimeSeriesWriter::flush() {
+    if (!m_file.isOpen()) throw FILE_NOT_OPEN;
+    writeBlock();
+    m_file.flush();
+}
+
+void TimeSeriesWriter::setWriteBehind(bool enabled) { m_file.setWriteBehind(enabled); }
+
+void TimeSeriesWriter::close() {
+    if (!m_file.isOpen()) return;
+    // close the file even if the last block cannot be written
+    try {
+        writeBlock();
+    } catch (const VFSException&) {
+        m_file.close();
+        throw;
+    }
+    m_file.close();
+}
+
+void TimeSeriesWriter::writeBlock() {
+    if (m_timestamps.empty()) return;
+    m_block.resize(sizeof(TimeSeriesBlock));
+    // timestamps at a steady rate have a delta of delta of 0, the first one is stored as its own delta
+    int64_t previous = 0;
+    int64_t previousDelta = 0;
+    for (size_t i = 0; i < m_timestamps.size(); i++) {
+        const int64_t delta = int64_t(m_timestamps[i]) - previous;
+        putVarint(m_block, zigzag(delta - previousDelta));
+        previousDelta = (i == 0) ? 0 : delta;
+        previous = m_timestamps[i];
+    }
+    // then each column of values as deltas
+    const size_t columns = m_scales.size();
+    for (size_t column = 0; column < columns; column++) {
+        int64_t previousValue = 0;
+        for (size_t i = 0; i < m_timestamps.size(); i++) {
+            const int64_t value = m_values[i * columns + column];
+            putVarint(m_block, zigzag(value - previousValue));
+            previousValue = value;
+        }
+    }
+    TimeSeriesBlock header = {static_cast<uint32_t>(m_timestamps.size()),
+                              static_cast<uint32_t>(m_block.size() - sizeof(header)), 0};
+    header.checksum = blockChecksum(header, m_block.data() + sizeof(header));
+    memcpy(m_block.data(), &header, sizeof(header));
+    m_timestamps.clear();
+    m_values.clear();
+    m_file.write(m_block.data(), m_block.size());
+}
+
+TimeSeriesReader::TimeSeriesReader(std::string_view path)
+    : m_path(path),
+      m_file(path, Mode::READ) {
+    TimeSeriesHeader header;
+    if (m_file.read(&header, sizeof(header)) != sizeof(header) || header.magic != TIME_SERIES_MAGIC ||
+        header.version != TIME_SERIES_VERSION)
+        throw CANNOT_READ_FILE(m_path);
+    m_scales.resize(header.columns);
+    const size_t scalesSize = m_scales.size() * sizeof(float);
+    if (m_file.read(m_scales.data(), scalesSize) != scalesSize) throw CANNOT_READ_FILE(m_path);
+}
+
+size_t TimeSeriesReader::columns() const { return m_scales.size(); }
+
+bool TimeSeriesReader::read(uint32_t& timestamp, float* values) {
+    if (m_next == m_timestamps.size() && !readBlock()) return false;
+    timestamp = m_timestamps[m_next];
+    const size_t columns = m_scales.size();
+    for (size_t i = 0; i < columns; i++) values[i] = float(m_values[m_next * columns + i] / double(m_scales[i]));
+    m_next++;
+    return true;
+}
+
+bool TimeSeriesReader::readBlock() {
+    m_timestamps.clear();
+    m_values.clear();
+    m_next = 0;
+    TimeSeriesBlock header;
+    // a block cut off at the end of the file is the one being written during a brown out
+    if (m_file.read(&header, sizeof(header)) != sizeof(header)) return false;
+    const size_t columns = m_scales.size();
+    // every varint takes between 1 and MAX_VARINT_SIZE bytes, compared by dividing so the sizes can't overflow
+    if (header.samples == 0 || header.size / (columns + 1) < header.samples ||
+        (header.size - 1) / (columns + 1) / MAX_VARINT_SIZE >= header.samples)
+        throw CANNOT_READ_FILE(m_path);
+    // checked against what is left of the file before allocating, since a torn header could ask for any size
+    if (header.size > m_file.size() - m_file.tell()) return false;
+    m_block.resize(header.size);
+    if (m_file.read(m_block.data(), header.size) != header.size) return false;
+    if (blockChecksum(header, m_block.data()) != header.checksum) return false;
+    // the checksum matched, so the varints are only checked to stay in bounds
+    const char* in = m_block.data();
+    const char* end = in + header.size;
+    m_timestamps.resize(header.samples);
+    m_values.resize(header.samples * columns);
+    uint64_t encoded;
+    int64_t previous = 0;
+    int64_t previousDelta = 0;
+    for (size_t i = 0; i < header.samples; i++) {
+        if (!getVarint(in, end, encoded)) break;
+        const int64_t delta = previousDelta + unzigzag(encoded);
+        previous += delta;
+        previousDelta = (i == 0) ? 0 : delta;
+        m_timestamps[i] = static_cast<uint32_t>(previous);
+    }
+    for (size_t column = 0; column < columns; column++) {
+        int64_t previousValue = 0;
+        for (size_t i = 0; i < header.samples; i++) {
+            if (!getVarint(in, end, encoded)) break;
+            previousValue += unzigzag(encoded);
+            m_values[i * columns + column] = static_cast<int32_t>(previousValue);
+        }
+    }
+    return true;
+}
+} // namespace fs
+} // namespace lemlib
@@ -6,13 +6,23 @@
 /*    Description:  LemLib Virtual File System                                */
 /*                                                                            */
 /*----------------------------------------------------------------------------*/
+#include "lemlib/vfs.hpp"
+#include "vfs_internal.hpp"
 #include <exception>
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <string_view>
 #include <sstream>
 #include <string.h>
 #include <algorithm>
+#include <map>
+#include <set>
+#include <cstdint>
+#include <cstdio>
+#include <charconv>
+#include <mutex>
+#include "pros/rtos.hpp"
 
 #if defined VEXV5
 #define PREFACE ""
@@ -20,137 +30,2352 @@
 #define PREFACE "/usd/"
 #endif
 
-// Exception codes
-#define VFS_NOT_INITIALIZED VFSException("VFS_NOT_INITIALIZED")
-#define VFS_INIT_FAILED VFSException("VFS_INIT_FAILED")
-#define FILE_NOT_FOUND(filename) (VFSException(std::string("FILE_NOT_FOUND (") + filename + ")"))
-#define FILE_ALREADY_EXISTS(filename) (VFSException(std::string("FILE_ALREADY_EXISTS (") + filename + ")"))
-#define CANNOT_OPEN_FILE(filename) (VFSException(std::string("CANNOT_OPEN_FILE (") + filename + ")"))
+/**
+ * @brief Normalize a path so it starts with a slash
+ *
+ * @param path the path
+ * @return std::string the normalized path
+ */
+std::string normalizePath(std::string_view path) {
+    std::string corrected_path;
+    corrected_path.reserve(path.size() + 1);
+    // If the path does not start with a slash, add one
+    if (path.empty() || path.front() != '/') corrected_path += '/';
+    corrected_path += path;
+    return corrected_path;
+}
+
+/**
+ * @brief Get the part of a path after the leading slash
+ *
+ * Lookups compare paths without their leading slash, so paths can be looked up without normalizing them first.
+ *
+ * @param path the path, with or without a leading slash
+ * @return std::string_view the path without the leading slash
+ */
+std::string_view pathKey(std::string_view path) {
+    if (!path.empty() && path.front() == '/') path.remove_prefix(1);
+    return path;
+}
+
+/**
+ * @brief Hash a path
+ *
+ * 32 bit FNV-1a. Cheap to compute on the brain and good enough to keep probe sequences short.
+ *
+ * @param key the path, without the leading slash
+ * @return uint32_t the hash of the path
+ */
+uint32_t hashPath(std::string_view key) {
+    uint32_t hash = 2166136261u;
+    for (const char c : key) hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    return hash;
+}
+
+/**
+ * @brief Compute the CRC-32 of a block of memory
+ *
+ * @param data the data to checksum
+ * @param size the number of bytes
+ * @param crc the checksum of the preceding data, to checksum several blocks as one
+ * @return uint32_t the checksum
+ */
+uint32_t crc32(const void* data, size_t size, uint32_t crc) {
+    static uint32_t table[256] = {};
+    // build the lookup table on first use
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/**
+ * @brief Header of the binary index file
+ *
+ * The index file is laid out as the header, followed by recordCount fixed size records, followed by a string table
+ * holding the names of all the files back to back, followed by the extent table holding the extents of the container
+ * files in the order of their records, followed by the contents of the inline files in the order of their records.
+ * The checksum covers the whole file, with the checksum in the header set to 0. Version 1 files have no generation and
+ * their checksum does not cover the header. Version 1 and 2 files have shorter records and no extent table, versions
+ * before 4 have no inline files and versions before 5 have no reserved files.
+ */
+typedef struct lemlibIndexHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t recordSize;
+        uint32_t recordCount;
+        uint32_t stringTableSize;
+        uint32_t checksum;
+        uint32_t generation;
+} lemlibIndexHeader;
+
+/**
+ * @brief Fixed size record in the binary index file
+ *
+ * @param sector the sector the file is stored in
+ * @param nameOffset the offset of the name of the file in the string table
+ * @param nameLength the length of the name of the file
+ * @param flags INDEX_CONTAINER if the file is stored in the containers, INDEX_INLINE if it is stored in the index,
+ * INDEX_RESERVED if its sector file has space reserved, INDEX_COMPRESSED if it is compressed
+ * @param length the length of a container, inline or reserved file in bytes, 0 for other sector files
+ * @param extentCount the number of extents of a container file in the extent table, 0 for sector files
+ */
+typedef struct lemlibIndexRecord {
+        uint32_t sector;
+        uint32_t nameOffset;
+        uint16_t nameLength;
+        uint16_t flags;
+        uint32_t length;
+        uint32_t extentCount;
+} lemlibIndexRecord;
+
+/**
+ * @brief Run of consecutive blocks in the containers
+ *
+ * @param firstBlock the first block, counting across all the containers
+ * @param blockCount the number of blocks
+ */
+typedef struct lemlibExtent {
+        uint32_t firstBlock;
+        uint32_t blockCount;
+} lemlibExtent;
+
+static_assert(sizeof(lemlibIndexHeader) == 24, "index header must not contain padding");
+static_assert(sizeof(lemlibIndexRecord) == 20, "index record must not contain padding");
+static_assert(sizeof(lemlibExtent) == 8, "extent must not contain padding");
+
+constexpr uint32_t INDEX_MAGIC = 0x5346564C; // "LVFS"
+constexpr uint16_t INDEX_VERSION = 5;
+constexpr size_t INDEX_V1_HEADER_SIZE = 20;
+// records of version 1 and 2 files end after the flags
+constexpr size_t INDEX_V2_RECORD_SIZE = 12;
+constexpr uint16_t INDEX_CONTAINER = 1;
+constexpr uint16_t INDEX_COMPRESSED = 2;
+constexpr uint16_t INDEX_INLINE = 4;
+constexpr uint16_t INDEX_RESERVED = 8;
+
+/**
+ * @brief The two slots the index file is written to
+ *
+ * Each write goes to the slot that does not hold the newest index, with a higher generation. If a brown out tears the
+ * write, the other slot still holds a valid index, so initVFS() just picks the valid slot with the highest generation.
+ */
+constexpr const char* INDEX_SLOTS[2] = {"/usd/indexa.bin", "/usd/indexb.bin"};
+
+/**
+ * @brief Header of a record in the index journal
+ *
+ * Changes to the index are appended to the journal instead of rewriting the index file. Each record is followed by
+ * its name, and by the new name for renames. The checksum covers the header (with the checksum set to 0) and the names,
+ * so a record torn by a brown out is detected when the journal is replayed. A batch record has no names, and its sector
+ * is the number of records after it that belong to the batch. They are only replayed if all of them are intact.
+ * The journal starts with a generation record, whose sector is the generation of the index file it applies to.
+ * Extent and length records describe a container file by its sector, and are followed by the extent or the length
+ * instead of a name. Data records replace the contents of an inline file by its sector and are followed by the
+ * contents, and promote records turn an inline file into a sector file. Reserve records mark a sector file as having
+ * space reserved and are followed by its length, which later length records update.
+ *
+ * @param type the kind of change
+ * @param flags JOURNAL_CONTAINER if a created file is stored in the containers, JOURNAL_INLINE if it is stored in the
+ * index, JOURNAL_COMPRESSED if it is compressed
+ * @param nameLength the length of the name of the file
+ * @param newNameLength the length of the new name of the file, or 0 if the record is not a rename
+ * @param sector the sector the file is stored in, or the number of records in a batch
+ * @param checksum the checksum of the record
+ */
+typedef struct lemlibJournalRecord {
+        uint8_t type;
+        uint8_t flags;
+        uint16_t nameLength;
+        uint16_t newNameLength;
+        uint16_t reserved2;
+        uint32_t sector;
+        uint32_t checksum;
+} lemlibJournalRecord;
+
+static_assert(sizeof(lemlibJournalRecord) == 16, "journal record must not contain padding");
+
+/**
+ * @brief Kinds of journal records
+ *
+ */
+enum JournalRecordType : uint8_t {
+    JOURNAL_CREATE = 1,
+    JOURNAL_DELETE = 2,
+    JOURNAL_RENAME = 3,
+    JOURNAL_BATCH = 4,
+    JOURNAL_GENERATION = 5,
+    JOURNAL_EXTENT = 6,
+    JOURNAL_LENGTH = 7,
+    JOURNAL_DATA = 8,
+    JOURNAL_PROMOTE = 9,
+    JOURNAL_RESERVE = 10
+};
+
+constexpr uint8_t JOURNAL_CONTAINER = 1;
+constexpr uint8_t JOURNAL_COMPRESSED = 2;
+constexpr uint8_t JOURNAL_INLINE = 4;
+
+// the journal is compacted into the index file once more than half of all records are dead
+constexpr size_t COMPACTION_MIN_RECORDS = 64;
+constexpr float COMPACTION_DEAD_RATIO = 0.5;
+
+// the length of a normalized path is stored in 16 bits by the index and the journal
+constexpr size_t MAX_PATH_LENGTH = UINT16_MAX;
+
+/**
+ * @brief Structure for an entry in the index
+ *
+ * @param nameOffset the offset of the normalized name of the file in fileNames
+ * @param nameLength the length of the name of the file
+ * @param flags INDEX_COMPRESSED if the file is compressed, container files are tracked in containerFiles instead
+ * @param sector the sector the file is stored in
+ * @param hash the hash of the name, computed once when the entry is created
+ */
+typedef struct lemlibFile {
+        uint32_t nameOffset;
+        uint16_t nameLength;
+        uint16_t flags;
+        uint32_t sector;
+        uint32_t hash;
+} lemlibFile;
+
+/**
+ * @brief Resident copy of the index file
+ *
+ * Loaded once by initVFS() and kept in sync by createFile() and deleteFile(), so lookups never touch the SD card.
+ * Call reloadVFS() if the index file is changed outside the VFS. The names of all the entries are interned back to back
+ * in fileNames, which is also the string table of the index file. Names of removed entries are only dropped from it
+ * when the index file is rewritten.
+ */
+static std::vector<lemlibFile> fileIndex;
+static std::string fileNames;
+static bool vfsInitialized = false;
+
+/**
+ * @brief State of the index journal
+ *
+ * Records in the index file and the journal that no longer describe a file are dead. They are counted so the journal
+ * can be compacted once they make up too much of it.
+ */
+static std::ofstream journalFile;
+static size_t totalRecords = 0;
+static size_t deadRecords = 0;
+// set while a compaction is queued to the VFS I/O task
+static bool compactionQueued = false;
+
+/**
+ * @brief Lock over the resident index and the journal
+ *
+ * Listings take it shared, so tasks can list directories in parallel, and everything that changes the index or appends
+ * to the journal takes it exclusively. Lookups use the snapshots of the index instead. The state of container, inline
+ * and reserved files has locks of its own, which are always taken after this one.
+ */
+static lemlib::fs::SharedMutex indexMutex;
+
+/**
+ * @brief Slot and generation of the newest index file, or -1 and 0 if there is none yet
+ *
+ */
+static int activeSlot = -1;
+static uint32_t indexGeneration = 0;
+
+/**
+ * @brief Get the name of an entry
+ *
+ * @param file the entry
+ * @return std::string_view the normalized name, only valid until the next entry is added
+ */
+std::string_view fileName(const lemlibFile& file) {
+    return std::string_view(fileNames).substr(file.nameOffset, file.nameLength);
+}
+
+/**
+ * @brief Open addressing hash table over the resident index
+ *
+ * Each slot holds the position of an entry in fileIndex, or EMPTY_SLOT. Collisions are resolved with linear probing.
+ * The capacity is always a power of two and at least twice the number of entries, so probe sequences stay short.
+ */
+static std::vector<int32_t> fileTable;
+constexpr int32_t EMPTY_SLOT = -1;
+constexpr size_t MIN_TABLE_SIZE = 64;
+
+/**
+ * @brief Bitmap of the sectors in use
+ *
+ * Bit n of word n / 32 is set if sector n is in use. It is rebuilt from the index when it is loaded, and updated
+ * whenever an entry is added or removed. firstFreeWord is never past the first word with a free sector, so the lowest
+ * free sector is found in amortized constant time and freed sectors are reused right away.
+ */
+static std::vector<uint32_t> sectorBitmap;
+static size_t firstFreeWord = 0;
+
+/**
+ * @brief Mark a sector as used
+ *
+ * @param sector the sector
+ */
+void markSectorUsed(uint32_t sector) {
+    if (sector / 32 >= sectorBitmap.size()) sectorBitmap.resize(sector / 32 + 1, 0);
+    sectorBitmap[sector / 32] |= 1u << (sector % 32);
+}
+
+/**
+ * @brief Mark a sector as free
+ *
+ * @param sector the sector
+ */
+void markSectorFree(uint32_t sector) {
+    if (sector / 32 >= sectorBitmap.size()) return;
+    sectorBitmap[sector / 32] &= ~(1u << (sector % 32));
+    firstFreeWord = std::min(firstFreeWord, size_t(sector / 32));
+}
+
+/**
+ * @brief Find the lowest free sector
+ *
+ * The sector is only marked as used once an entry is added for it.
+ *
+ * @return uint32_t the sector
+ */
+uint32_t findFreeSector() {
+    while (firstFreeWord < sectorBitmap.size() && sectorBitmap[firstFreeWord] == 0xFFFFFFFF) firstFreeWord++;
+    if (firstFreeWord == sectorBitmap.size()) sectorBitmap.push_back(0);
+    return firstFreeWord * 32 + __builtin_ctz(~sectorBitmap[firstFreeWord]);
+}
+
+/**
+ * @brief Layout of the containers
+ *
+ * Container files are stored in extents of the containers, large data files that are preallocated on the SD card when
+ * the first block in them is handed out, so opening a container file only takes an index lookup and a seek. Blocks are
+ * numbered across all the containers, and an extent never spans two containers.
+ */
+constexpr size_t CONTAINER_BLOCK_SIZE = 512;
+constexpr uint32_t CONTAINER_BLOCKS = 8192;
+
+/**
+ * @brief Resident state of a container file
+ *
+ * @param length the length of the file in bytes
+ * @param extents the extents of the file, in file order
+ * @param committedLength the length last recorded in the index journal
+ * @param committedExtents the number of extents recorded in the index journal, the others are only allocated in memory
+ */
+typedef struct lemlibContainerFile {
+        uint32_t length;
+        std::vector<lemlibExtent> extents;
+        uint32_t committedLength;
+        size_t committedExtents;
+} lemlibContainerFile;
+
+/**
+ * @brief Resident state of the containers
+ *
+ * containerFiles holds the container files by sector. blockBitmap works like sectorBitmap, for the blocks of the
+ * containers. The containers are opened once and shared by all the file handles. All of this is guarded by
+ * containerMutex, since the write-behind task writes to container files too.
+ */
+static std::map<uint32_t, lemlibContainerFile> containerFiles;
+static std::vector<uint32_t> blockBitmap;
+static size_t firstFreeBlockWord = 0;
+static std::vector<std::fstream> containers;
+static pros::Mutex containerMutex;
+static lemlib::fs::Storage defaultStorage = lemlib::fs::Storage::SECTOR_FILE;
+static bool defaultCompression = false;
+
+/**
+ * @brief Resident state of an inline file
+ *
+ * @param data the contents of the file
+ * @param committed whether the contents are recorded in the index file or the journal
+ * @param journaled whether a data record in the journal holds the contents
+ */
+typedef struct lemlibInlineFile {
+        std::string data;
+        bool committed;
+        bool journaled;
+} lemlibInlineFile;
+
+// inline files are never larger than this, so their data records stay small
+constexpr size_t MAX_INLINE_THRESHOLD = 1024;
+
+/**
+ * @brief Resident state of the inline files
+ *
+ * Inline files are stored in the index itself instead of a sector file, so they are read without opening anything.
+ * inlineFiles holds them by sector, guarded by inlineMutex since the write-behind task writes to them too. Files
+ * created while the threshold is not 0 start inline, and are turned into sector files once they would grow past it.
+ */
+static std::map<uint32_t, lemlibInlineFile> inlineFiles;
+static pros::Mutex inlineMutex;
+static size_t inlineThreshold = 0;
+
+/**
+ * @brief Resident state of a reserved sector file
+ *
+ * @param length the length of the data in bytes, the sector file is larger by the space reserved after it
+ * @param committedLength the length last recorded in the index journal
+ */
+typedef struct lemlibReservedFile {
+        uint32_t length;
+        uint32_t committedLength;
+} lemlibReservedFile;
+
+/**
+ * @brief Resident state of the reserved sector files
+ *
+ * The sector file of a reserved file is grown once by reserve(), so writes within it never make the FAT allocate
+ * clusters. Its length is tracked here instead of being the size of the sector file, guarded by reservedMutex since
+ * the write-behind task writes to reserved files too. Like the length of container files, it is only recorded in the
+ * journal when the file is flushed or closed.
+ */
+static std::map<uint32_t, lemlibReservedFile> reservedFiles;
+static pros::Mutex reservedMutex;
+
+/**
+ * @brief Get the journal flags of files created with the current defaults
+ *
+ * @return uint8_t the flags of their creation records
+ */
+uint8_t newFileFlags() {
+    uint8_t flags = 0;
+    if (defaultStorage == lemlib::fs::Storage::CONTAINER) flags |= JOURNAL_CONTAINER;
+    // compressed files are only appended to, so they are never tiny for long
+    else if (inlineThreshold > 0 && !defaultCompression) flags |= JOURNAL_INLINE;
+    if (defaultCompression) flags |= JOURNAL_COMPRESSED;
+    return flags;
+}
+
+/**
+ * @brief Get the path of a container
+ *
+ * @param container the number of the container
+ * @return std::string the path of the container
+ */
+std::string getContainerPath(size_t container) { return "/usd/data" + std::to_string(container) + ".bin"; }
+
+/**
+ * @brief Mark the blocks of an extent as used or free
+ *
+ * @param extent the extent
+ * @param used whether the blocks are used
+ */
+void markBlocks(const lemlibExtent& extent, bool used) {
+    for (uint32_t block = extent.firstBlock; block < extent.firstBlock + extent.blockCount; block++) {
+        if (block / 32 >= blockBitmap.size()) blockBitmap.resize(block / 32 + 1, 0);
+        if (used) blockBitmap[block / 32] |= 1u << (block % 32);
+        else blockBitmap[block / 32] &= ~(1u << (block % 32));
+    }
+    if (!used) firstFreeBlockWord = std::min(firstFreeBlockWord, size_t(extent.firstBlock / 32));
+}
+
+/**
+ * @brief Check if a block is free
+ *
+ * @param block the block
+ * @return true the block is free
+ * @return false the block is used
+ */
+bool isBlockFree(uint32_t block) {
+    return block / 32 >= blockBitmap.size() || (blockBitmap[block / 32] & (1u << (block % 32))) == 0;
+}
+
+/**
+ * @brief Open a container, creating and preallocating it if needed
+ *
+ * @param container the number of the container
+ * @return std::fstream& the open container
+ */
+std::fstream& openContainer(size_t container) {
+    if (containers.size() <= container) containers.resize(container + 1);
+    std::fstream& stream = containers[container];
+    if (stream.is_open()) return stream;
+    const std::string path = getContainerPath(container);
+    std::ofstream(path, std::ios_base::app | std::ios_base::binary);
+    stream.open(path, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+    if (!stream.is_open()) throw CANNOT_OPEN_FILE(path);
+    // allocate the clusters of the whole container up front by writing its last byte
+    stream.seekp(0, std::ios_base::end);
+    if (static_cast<size_t>(stream.tellp()) < CONTAINER_BLOCKS * CONTAINER_BLOCK_SIZE) {
+        stream.seekp(CONTAINER_BLOCKS * CONTAINER_BLOCK_SIZE - 1);
+        stream.put('\0');
+        stream.flush();
+        if (!stream) throw CANNOT_WRITE_FILE(path);
+    }
+    return stream;
+}
+
+/**
+ * @brief Give a container file at least a number of blocks
+ *
+ * The last extent grows in place if the blocks after it are free and it was not recorded in the journal yet, otherwise
+ * new extents are added, each starting at the lowest free block.
+ *
+ * @param file the container file
+ * @param blocks the number of blocks the file needs
+ */
+void allocateBlocks(lemlibContainerFile& file, uint32_t blocks) {
+    uint32_t allocated = 0;
+    for (const lemlibExtent& extent : file.extents) allocated += extent.blockCount;
+    while (allocated < blocks) {
+        lemlibExtent* last = file.extents.size() > file.committedExtents ? &file.extents.back() : nullptr;
+        uint32_t next;
+        if (last != nullptr && (last->firstBlock + last->blockCount) % CONTAINER_BLOCKS != 0 &&
+            isBlockFree(last->firstBlock + last->blockCount)) {
+            next = last->firstBlock + last->blockCount;
+        } else {
+            while (firstFreeBlockWord < blockBitmap.size() && blockBitmap[firstFreeBlockWord] == 0xFFFFFFFF)
+                firstFreeBlockWord++;
+            next = (firstFreeBlockWord < blockBitmap.size())
+                       ? firstFreeBlockWord * 32 + __builtin_ctz(~blockBitmap[firstFreeBlockWord])
+                       : firstFreeBlockWord * 32;
+            file.extents.push_back({next, 0});
+            last = &file.extents.back();
+        }
+        openContainer(next / CONTAINER_BLOCKS);
+        // take free blocks after the first one until the file has enough or the container ends
+        do {
+            markBlocks({next, 1}, true);
+            last->blockCount++;
+            allocated++;
+            next++;
+        } while (allocated < blocks && next % CONTAINER_BLOCKS != 0 && isBlockFree(next));
+    }
+}
+
+/**
+ * @brief Read or write part of a container file within its extents
+ *
+ * @param file the container file
+ * @param offset the offset in the file
+ * @param data the bytes to write, or where to store the bytes read
+ * @param size the number of bytes
+ * @param write whether to write instead of reading
+ * @return true all the bytes were transferred
+ * @return false a container could not be read or written
+ */
+bool transferContainer(const lemlibContainerFile& file, size_t offset, char* data, size_t size, bool write) {
+    size_t extentStart = 0;
+    for (const lemlibExtent& extent : file.extents) {
+        const size_t extentSize = size_t(extent.blockCount) * CONTAINER_BLOCK_SIZE;
+        if (size == 0) break;
+        if (offset < extentStart + extentSize) {
+            const size_t n = std::min(size, extentStart + extentSize - offset);
+            const size_t block = extent.firstBlock;
+            std::fstream& stream = openContainer(block / CONTAINER_BLOCKS);
+            const size_t position = (block % CONTAINER_BLOCKS) * CONTAINER_BLOCK_SIZE + (offset - extentStart);
+            stream.clear();
+            if (write) {
+                stream.seekp(position);
+                stream.write(data, n);
+            } else {
+                stream.seekg(position);
+                stream.read(data, n);
+            }
+            if (!stream) return false;
+            offset += n;
+            data += n;
+            size -= n;
+        }
+        extentStart += extentSize;
+    }
+    return size == 0;
+}
+
+/**
+ * @brief Remove a container file and free its blocks
+ *
+ * Has no effect on sector files.
+ *
+ * @param sector the sector of the file
+ * @return size_t the number of journal records that described the file, besides its creation
+ */
+size_t freeContainerFile(uint32_t sector) {
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    const auto it = containerFiles.find(sector);
+    if (it == containerFiles.end()) return 0;
+    for (const lemlibExtent& extent : it->second.extents) markBlocks(extent, false);
+    const size_t records = it->second.committedExtents + (it->second.committedLength != 0);
+    containerFiles.erase(it);
+    return records;
+}
+
+/**
+ * @brief Remove an inline file
+ *
+ * Has no effect on other files.
+ *
+ * @param sector the sector of the file
+ * @return size_t the number of journal records that described the file, besides its creation
+ */
+size_t freeInlineFile(uint32_t sector) {
+    std::lock_guard<pros::Mutex> lock(inlineMutex);
+    const auto it = inlineFiles.find(sector);
+    if (it == inlineFiles.end()) return 0;
+    const size_t records = it->second.journaled;
+    inlineFiles.erase(it);
+    return records;
+}
+
+/**
+ * @brief Forget the reservation of a sector file
+ *
+ * Has no effect on other files.
+ *
+ * @param sector the sector of the file
+ * @return size_t the number of journal records that described the file, besides its creation
+ */
+size_t freeReservedFile(uint32_t sector) {
+    std::lock_guard<pros::Mutex> lock(reservedMutex);
+    return reservedFiles.erase(sector);
+}
+
+/**
+ * @brief Rebuild a hash table over entries
+ *
+ * @param table the hash table
+ * @param files the entries the table points to
+ * @param capacity the minimum number of slots
+ */
+void rebuildFileTable(std::vector<int32_t>& table, const std::vector<lemlibFile>& files, size_t capacity) {
+    size_t size = MIN_TABLE_SIZE;
+    while (size < capacity || size < files.size() * 2) size *= 2;
+    table.assign(size, EMPTY_SLOT);
+    const size_t mask = size - 1;
+    for (size_t i = 0; i < files.size(); i++) {
+        size_t slot = files[i].hash & mask;
+        while (table[slot] != EMPTY_SLOT) slot = (slot + 1) & mask;
+        table[slot] = static_cast<int32_t>(i);
+    }
+}
+
+/**
+ * @brief Rebuild the hash table from the resident index
+ *
+ * @param capacity the minimum number of slots
+ */
+void rebuildFileTable(size_t capacity = MIN_TABLE_SIZE) { rebuildFileTable(fileTable, fileIndex, capacity); }
+
+/**
+ * @brief Node of the directory tree
+ *
+ * @param parent the node of the parent directory
+ * @param name the name of the directory, without slashes
+ * @param directories the nodes of the subdirectories, by name
+ * @param files the names of the files in the directory
+ */
+typedef struct lemlibDirectory {
+        uint32_t parent;
+        std::string name;
+        std::map<std::string, uint32_t, std::less<>> directories;
+        std::set<std::string, std::less<>> files;
+} lemlibDirectory;
+
+/**
+ * @brief Directory tree over the resident index
+ *
+ * Node 0 is the root directory. Directories only exist while they contain files, so the nodes of removed directories
+ * are kept in freeDirectories to be reused.
+ */
+static std::vector<lemlibDirectory> directories;
+static std::vector<uint32_t> freeDirectories;
+
+/**
+ * @brief Add a file to the directory tree, creating its parent directories as needed
+ *
+ * @param key the path of the file, without the leading slash
+ */
+void insertIntoTree(std::string_view key) {
+    uint32_t node = 0;
+    size_t start = 0;
+    for (size_t end = key.find('/', start); end != std::string_view::npos; end = key.find('/', start)) {
+        const std::string_view name = key.substr(start, end - start);
+        const auto it = directories[node].directories.find(name);
+        if (it != directories[node].directories.end()) {
+            node = it->second;
+        } else {
+            // create the directory, reusing a free node if there is one
+            uint32_t child;
+            if (!freeDirectories.empty()) {
+                child = freeDirectories.back();
+                freeDirectories.pop_back();
+                directories[child] = {node, std::string(name), {}, {}};
+            } else {
+                child = static_cast<uint32_t>(directories.size());
+                directories.push_back({node, std::string(name), {}, {}});
+            }
+            directories[node].directories.emplace(name, child);
+            node = child;
+        }
+        start = end + 1;
+    }
+    directories[node].files.emplace(key.substr(start));
+}
+
+/**
+ * @brief Find a directory in the directory tree
+ *
+ * @param key the path of the directory without the leading slash, with or without a trailing slash
+ * @return int32_t the node of the directory, or -1 if it does not exist
+ */
+int32_t findDirectory(std::string_view key) {
+    uint32_t node = 0;
+    size_t start = 0;
+    while (start < key.size()) {
+        size_t end = key.find('/', start);
+        if (end == std::string_view::npos) end = key.size();
+        const auto it = directories[node].directories.find(key.substr(start, end - start));
+        if (it == directories[node].directories.end()) return -1;
+        node = it->second;
+        start = end + 1;
+    }
+    return static_cast<int32_t>(node);
+}
+
+/**
+ * @brief Remove a file from the directory tree, along with any directories left empty
+ *
+ * @param key the path of the file, without the leading slash
+ */
+void removeFromTree(std::string_view key) {
+    const size_t last_slash_pos = key.find_last_of('/');
+    const bool inRoot = last_slash_pos == std::string_view::npos;
+    const int32_t found = inRoot ? 0 : findDirectory(key.substr(0, last_slash_pos));
+    if (found == -1) return;
+    uint32_t node = static_cast<uint32_t>(found);
+    const auto file = directories[node].files.find(key.substr(inRoot ? 0 : last_slash_pos + 1));
+    if (file != directories[node].files.end()) directories[node].files.erase(file);
+    while (node != 0 && directories[node].files.empty() && directories[node].directories.empty()) {
+        const uint32_t parent = directories[node].parent;
+        directories[parent].directories.erase(directories[node].name);
+        directories[node].name.clear();
+        freeDirectories.push_back(node);
+        node = parent;
+    }
+}
+
+/**
+ * @brief Add the paths of all the files below a directory to a vector
+ *
+ * @param node the node of the directory
+ * @param prefix the path of the directory relative to the directory being listed
+ * @param files the vector to add the paths to
+ */
+void listSubtree(uint32_t node, const std::string& prefix, std::vector<std::string>& files) {
+    for (const std::string& file : directories[node].files) files.push_back(prefix + file);
+    for (const auto& directory : directories[node].directories)
+        listSubtree(directory.second, prefix + directory.first + "/", files);
+}
+
+/**
+ * @brief Find the slot of a path in a hash table over entries
+ *
+ * @param table the hash table
+ * @param files the entries the table points to
+ * @param names the string table of the names of the entries
+ * @param key the path, without the leading slash
+ * @param hash the hash of the path
+ * @return size_t the slot holding the entry, or the empty slot where it would be inserted
+ */
+size_t findFileSlot(const std::vector<int32_t>& table, const std::vector<lemlibFile>& files, std::string_view names,
+                    std::string_view key, uint32_t hash) {
+    const size_t mask = table.size() - 1;
+    size_t slot = hash & mask;
+    while (table[slot] != EMPTY_SLOT) {
+        const lemlibFile& file = files[table[slot]];
+        // only compare the strings if the stored hashes match
+        if (file.hash == hash && pathKey(names.substr(file.nameOffset, file.nameLength)) == key) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * @brief Find the slot of a path in the hash table over the resident index
+ *
+ * @param key the path, without the leading slash
+ * @param hash the hash of the path
+ * @return size_t the slot holding the entry, or the empty slot where it would be inserted
+ */
+size_t findFileSlot(std::string_view key, uint32_t hash) {
+    return findFileSlot(fileTable, fileIndex, fileNames, key, hash);
+}
+
+/**
+ * @brief Find an entry in the resident index
+ *
+ * Does not allocate any memory.
+ *
+ * @param path the path, with or without a leading slash
+ * @return const lemlibFile* the entry, or nullptr if the file is not found
+ */
+const lemlibFile* findFile(std::string_view path) {
+    const std::string_view key = pathKey(path);
+    const int32_t i = fileTable[findFileSlot(key, hashPath(key))];
+    return (i != EMPTY_SLOT) ? &fileIndex[i] : nullptr;
+}
+
+/**
+ * @brief Add an entry to a hash table over entries
+ *
+ * @param table the hash table
+ * @param files the entries the table points to
+ * @param names the string table of the names of the entries, which the normalized name is appended to
+ * @param file the entry, whose name offset and length are set here
+ * @param key the path of the entry, without the leading slash
+ */
+void addEntry(std::vector<int32_t>& table, std::vector<lemlibFile>& files, std::string& names, lemlibFile file,
+              std::string_view key) {
+    file.nameOffset = static_cast<uint32_t>(names.size());
+    file.nameLength = static_cast<uint16_t>(key.size() + 1);
+    files.push_back(file);
+    names += '/';
+    names += key;
+    // grow the table before it gets more than half full
+    if (files.size() * 2 > table.size()) {
+        rebuildFileTable(table, files, table.size() * 2);
+        return;
+    }
+    table[findFileSlot(table, files, names, key, file.hash)] = static_cast<int32_t>(files.size() - 1);
+}
+
+/**
+ * @brief Remove an entry from a hash table over entries
+ *
+ * The last entry is moved into the hole, so removing an entry takes constant time. The name of the entry stays in the
+ * string table.
+ *
+ * @param table the hash table
+ * @param files the entries the table points to
+ * @param slot the slot holding the entry
+ */
+void eraseEntry(std::vector<int32_t>& table, std::vector<lemlibFile>& files, size_t slot) {
+    const size_t mask = table.size() - 1;
+    const int32_t removed = table[slot];
+    // backward shift deletion, so no tombstones are needed
+    for (size_t next = (slot + 1) & mask; table[next] != EMPTY_SLOT; next = (next + 1) & mask) {
+        const size_t home = files[table[next]].hash & mask;
+        // move the entry into the hole if the hole lies on its probe sequence
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            table[slot] = table[next];
+            slot = next;
+        }
+    }
+    table[slot] = EMPTY_SLOT;
+    // move the last entry into the hole
+    const int32_t last = static_cast<int32_t>(files.size() - 1);
+    if (removed != last) {
+        size_t movedSlot = files[last].hash & mask;
+        while (table[movedSlot] != last) movedSlot = (movedSlot + 1) & mask;
+        table[movedSlot] = removed;
+        files[removed] = files[last];
+    }
+    files.pop_back();
+}
+
+/**
+ * @brief Copy of the entries of the resident index and the hash table over them, for lookups
+ *
+ * Lookups read the published snapshot without taking any lock, so a task looking a file up never waits for a task that
+ * is changing the index, whatever their priorities. There are two snapshots, and they take turns: writers change the
+ * resident index under the index lock and apply the same changes to the snapshot that is not published, which is
+ * published when they release the lock. The other one is then brought up to date at the start of the next change, by
+ * replaying the changes it missed, so changing the index never copies all of it. Names of removed entries stay in the
+ * string table until the index file is rewritten, when the snapshots are copied from the resident index instead.
+ *
+ * @param files the entries of the index
+ * @param names the string table of the names of the entries
+ * @param table the hash table over the entries
+ * @param references the number of lookups using the snapshot
+ * @param outdated whether the snapshot must be copied from the resident index instead of replaying changes onto it,
+ * only used with the index lock held exclusively
+ */
+typedef struct lemlibSnapshot {
+        std::vector<lemlibFile> files;
+        std::string names;
+        std::vector<int32_t> table;
+        std::atomic<uint32_t> references;
+        bool outdated;
+} lemlibSnapshot;
+
+/**
+ * @brief A change of the resident index that a snapshot has not seen yet
+ *
+ * @param inserted whether the entry was added or removed
+ * @param file the entry, whose name is in fileNames
+ */
+typedef struct lemlibSnapshotChange {
+        bool inserted;
+        lemlibFile file;
+} lemlibSnapshotChange;
+
+/**
+ * @brief The snapshots and their state
+ *
+ * currentSnapshot is nullptr while the VFS is not initialized. A lookup takes a reference to the published snapshot
+ * and checks that it is still published, so once the writer sees no references on a replaced snapshot, no lookup reads
+ * it anymore. The writer waits on snapshotDrained for the lookups still using it, which the last one gives if
+ * drainingSnapshot is that snapshot. Everything else is only used with the index lock held exclusively.
+ * snapshotChanges holds the changes the published snapshot already has but nextSnapshot has not seen yet, followed by
+ * the changes of the current batch once it is prepared.
+ */
+static lemlibSnapshot snapshots[2] = {{{}, {}, {}, 0, true}, {{}, {}, {}, 0, true}};
+static std::atomic<lemlibSnapshot*> currentSnapshot = nullptr;
+static std::atomic<lemlibSnapshot*> drainingSnapshot = nullptr;
+static pros::c::sem_t snapshotDrained = pros::c::sem_binary_create();
+static lemlibSnapshot* nextSnapshot = &snapshots[0];
+static std::vector<lemlibSnapshotChange> snapshotChanges;
+static bool snapshotPrepared = false;
+static bool snapshotStale = false;
+static size_t writeDepth = 0;
+
+/**
+ * @brief Apply a change of the resident index to a snapshot
+ *
+ * @param snapshot the snapshot, which no lookup may be using
+ * @param change the change
+ */
+void applyChange(lemlibSnapshot& snapshot, const lemlibSnapshotChange& change) {
+    const std::string_view key = pathKey(fileName(change.file));
+    if (change.inserted) {
+        addEntry(snapshot.table, snapshot.files, snapshot.names, change.file, key);
+        return;
+    }
+    const size_t slot = findFileSlot(snapshot.table, snapshot.files, snapshot.names, key, change.file.hash);
+    if (snapshot.table[slot] != EMPTY_SLOT) eraseEntry(snapshot.table, snapshot.files, slot);
+}
+
+/**
+ * @brief Wait for the lookups still using the unpublished snapshot, once per batch
+ *
+ * They took it before it was replaced, and only hold it for a lookup.
+ */
+void drainSnapshot() {
+    if (snapshotPrepared) return;
+    drainingSnapshot = nextSnapshot;
+    while (nextSnapshot->references != 0) pros::c::sem_wait(snapshotDrained, TIMEOUT_MAX);
+    drainingSnapshot = nullptr;
+    snapshotPrepared = true;
+}
+
+/**
+ * @brief Copy the resident index into the unpublished snapshot, after a change of all of it
+ *
+ */
+void copySnapshot() {
+    drainSnapshot();
+    lemlibSnapshot& snapshot = *nextSnapshot;
+    snapshot.outdated = true;
+    snapshotChanges.clear();
+    snapshot.files = fileIndex;
+    snapshot.names = fileNames;
+    snapshot.table = fileTable;
+    snapshot.outdated = false;
+    // the published snapshot may be missing changes that were never published, so it is copied too
+    (nextSnapshot == &snapshots[0] ? snapshots[1] : snapshots[0]).outdated = true;
+    snapshotStale = true;
+}
+
+/**
+ * @brief Bring the unpublished snapshot up to date, before a change of the resident index
+ *
+ */
+void prepareSnapshot() {
+    if (!snapshotPrepared) {
+        drainSnapshot();
+        lemlibSnapshot& snapshot = *nextSnapshot;
+        if (snapshot.outdated) {
+            copySnapshot();
+        } else {
+            // replaying may run out of memory halfway, which leaves the snapshot to be copied instead
+            snapshot.outdated = true;
+            for (const lemlibSnapshotChange& change : snapshotChanges) applyChange(snapshot, change);
+            snapshot.outdated = false;
+            snapshotChanges.clear();
+        }
+    }
+    snapshotStale = true;
+}
+
+/**
+ * @brief Apply a change of the resident index to the unpublished snapshot, after prepareSnapshot()
+ *
+ * @param inserted whether the entry was added or removed
+ * @param file the entry
+ */
+void updateSnapshot(bool inserted, const lemlibFile& file) {
+    // an outdated snapshot is copied before it is published anyway
+    if (nextSnapshot->outdated) return;
+    nextSnapshot->outdated = true;
+    snapshotChanges.push_back({inserted, file});
+    applyChange(*nextSnapshot, snapshotChanges.back());
+    nextSnapshot->outdated = false;
+}
+
+/**
+ * @brief Drop the changes waiting to be replayed onto the unpublished snapshot, before the resident index is replaced
+ *
+ */
+void discardSnapshotChanges() {
+    nextSnapshot->outdated = true;
+    snapshotChanges.clear();
+}
+
+/**
+ * @brief Publish the unpublished snapshot, which the other one replaces as the unpublished snapshot
+ *
+ * Only swaps pointers, so it can be called from a destructor. If a change of the snapshot failed, the published
+ * snapshot is kept until the next change, which copies the resident index instead.
+ */
+void publishSnapshot() noexcept {
+    snapshotStale = false;
+    snapshotPrepared = false;
+    if (!vfsInitialized) {
+        currentSnapshot = nullptr;
+        return;
+    }
+    if (nextSnapshot->outdated) return;
+    currentSnapshot = nextSnapshot;
+    nextSnapshot = (nextSnapshot == &snapshots[0]) ? &snapshots[1] : &snapshots[0];
+}
+
+/**
+ * @brief Reference to the published snapshot, held for the duration of a lookup
+ *
+ * Taking one is lock-free: a few atomic operations, retried only if the snapshot is replaced in between.
+ */
+class SnapshotReference {
+    public:
+        SnapshotReference() {
+            while (true) {
+                m_snapshot = currentSnapshot.load();
+                if (m_snapshot == nullptr) return;
+                m_snapshot->references++;
+                // the writer only waits for the references it sees, so the snapshot must still be published now
+                if (currentSnapshot.load() == m_snapshot) return;
+                release();
+            }
+        }
+
+        ~SnapshotReference() {
+            if (m_snapshot != nullptr) release();
+        }
+
+        SnapshotReference(const SnapshotReference&) = delete;
+        SnapshotReference& operator=(const SnapshotReference&) = delete;
+
+        /**
+         * @brief Find an entry in the snapshot
+         *
+         * Does not allocate any memory.
+         *
+         * @param path the path, with or without a leading slash
+         * @return const lemlibFile* the entry, valid while the reference is held, or nullptr if the file is not found
+         */
+        const lemlibFile* findFile(std::string_view path) const {
+            if (m_snapshot == nullptr) throw VFS_NOT_INITIALIZED;
+            const std::string_view key = pathKey(path);
+            const int32_t i = m_snapshot->table[findFileSlot(m_snapshot->table, m_snapshot->files, m_snapshot->names,
+                                                             key, hashPath(key))];
+            return (i != EMPTY_SLOT) ? &m_snapshot->files[i] : nullptr;
+        }
+    private:
+        /**
+         * @brief Give the reference back, waking the writer if it waits for the snapshot
+         *
+         */
+        void release() {
+            // references is decremented before drainingSnapshot is read, and the writer sets drainingSnapshot before
+            // reading references, so either the writer sees no references or the last lookup sees the writer
+            if (--m_snapshot->references == 0 && drainingSnapshot == m_snapshot) pros::c::sem_post(snapshotDrained);
+        }
+
+        lemlibSnapshot* m_snapshot;
+};
+
+/**
+ * @brief Holds the index lock exclusively, and publishes the prepared snapshot when the outermost holder releases it
+ *
+ * Functions that change the index call each other, so a batch of changes is published as a single snapshot.
+ */
+class IndexWriteLock {
+    public:
+        IndexWriteLock() {
+            indexMutex.lock();
+            writeDepth++;
+        }
+
+        ~IndexWriteLock() {
+            if (--writeDepth == 0 && snapshotStale) publishSnapshot();
+            indexMutex.unlock();
+        }
+
+        IndexWriteLock(const IndexWriteLock&) = delete;
+        IndexWriteLock& operator=(const IndexWriteLock&) = delete;
+};
+
+/**
+ * @brief Check that a path fits in the index and the journal once it is normalized
+ *
+ * @param path the path, with or without a leading slash
+ */
+void checkPathLength(std::string_view path) {
+    if (pathKey(path).size() + 1 > MAX_PATH_LENGTH) throw PATH_TOO_LONG(normalizePath(path));
+}
+
+/**
+ * @brief Add an entry to the resident index
+ *
+ * @param path the path, which must not be in the index yet
+ * @param sector the sector the file is stored in
+ * @param flags the flags of the entry
+ */
+void insertFile(std::string_view path, uint32_t sector, uint16_t flags = 0) {
+    const std::string_view key = pathKey(path);
+    checkPathLength(path);
+    prepareSnapshot();
+    // intern the normalized name
+    addEntry(fileTable, fileIndex, fileNames, {0, 0, flags, sector, hashPath(key)}, key);
+    markSectorUsed(sector);
+    insertIntoTree(key);
+    updateSnapshot(true, fileIndex.back());
+}
+
+/**
+ * @brief Remove an entry from the resident index
+ *
+ * The last entry is moved into the hole, so removing an entry takes constant time.
+ *
+ * @param path the path, with or without a leading slash
+ */
+void removeFile(std::string_view path) {
+    const std::string_view key = pathKey(path);
+    const size_t slot = findFileSlot(key, hashPath(key));
+    if (fileTable[slot] == EMPTY_SLOT) return;
+    // the name stays in fileNames, so the copy can be replayed onto the snapshot
+    const lemlibFile removed = fileIndex[fileTable[slot]];
+    prepareSnapshot();
+    removeFromTree(key);
+    eraseEntry(fileTable, fileIndex, slot);
+    markSectorFree(removed.sector);
+    updateSnapshot(false, removed);
+}
+
+/**
+ * @brief Remove an entry from the resident index and free the blocks of a container file or the data of an inline file
+ *
+ * @param path the path, which must be in the index
+ * @return size_t the number of journal records that described the file, besides its creation
+ */
+size_t deleteEntry(std::string_view path) {
+    const uint32_t sector = findFile(path)->sector;
+    removeFile(path);
+    lemlib::fs::invalidateCache(sector);
+    return freeContainerFile(sector) + freeInlineFile(sector) + freeReservedFile(sector);
+}
+
+/**
+ * @brief Rebuild the hash table, the sector and block bitmaps and the directory tree from the resident index
+ *
+ */
+void rebuildLookups() {
+    rebuildFileTable();
+    copySnapshot();
+    sectorBitmap.clear();
+    firstFreeWord = 0;
+    directories.assign(1, {0, "", {}, {}});
+    freeDirectories.clear();
+    for (const lemlibFile& file : fileIndex) {
+        markSectorUsed(file.sector);
+        insertIntoTree(pathKey(fileName(file)));
+    }
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    blockBitmap.clear();
+    firstFreeBlockWord = 0;
+    for (const auto& file : containerFiles)
+        for (const lemlibExtent& extent : file.second.extents) markBlocks(extent, true);
+}
+
+/**
+ * @brief Write the resident index to the inactive index slot
+ *
+ * The names of deleted files are dropped from the string table while it is written.
+ */
+void writeFileIndex() {
+    const int slot = (activeSlot == 0) ? 1 : 0;
+    // build the whole file in memory so it can be written with a single call
+    lemlibIndexHeader header = {INDEX_MAGIC,
+                                INDEX_VERSION,
+                                sizeof(lemlibIndexRecord),
+                                static_cast<uint32_t>(fileIndex.size()),
+                                0,
+                                0,
+                                indexGeneration + 1};
+    std::vector<char> buffer(sizeof(header) + fileIndex.size() * sizeof(lemlibIndexRecord));
+    prepareSnapshot();
+    std::string names;
+    names.reserve(fileNames.size());
+    std::vector<lemlibExtent> extents;
+    std::string inlineData;
+    // container, inline and reserved files must not change until they are marked as committed below
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    std::lock_guard<pros::Mutex> inlineLock(inlineMutex);
+    std::lock_guard<pros::Mutex> reservedLock(reservedMutex);
+    char* record = buffer.data() + sizeof(header);
+    for (lemlibFile& file : fileIndex) {
+        const uint32_t nameOffset = static_cast<uint32_t>(names.size());
+        names.append(fileNames, file.nameOffset, file.nameLength);
+        file.nameOffset = nameOffset;
+        lemlibIndexRecord entry = {file.sector, file.nameOffset, file.nameLength, file.flags, 0, 0};
+        const auto container = containerFiles.find(file.sector);
+        if (container != containerFiles.end()) {
+            entry.flags |= INDEX_CONTAINER;
+            entry.length = container->second.length;
+            entry.extentCount = static_cast<uint32_t>(container->second.extents.size());
+            extents.insert(extents.end(), container->second.extents.begin(), container->second.extents.end());
+        }
+        const auto inlined = inlineFiles.find(file.sector);
+        if (inlined != inlineFiles.end()) {
+            entry.flags |= INDEX_INLINE;
+            entry.length = static_cast<uint32_t>(inlined->second.data.size());
+            inlineData += inlined->second.data;
+        }
+        const auto reserved = reservedFiles.find(file.sector);
+        if (reserved != reservedFiles.end()) {
+            entry.flags |= INDEX_RESERVED;
+            entry.length = reserved->second.length;
+        }
+        memcpy(record, &entry, sizeof(entry));
+        record += sizeof(entry);
+    }
+    fileNames = std::move(names);
+    // the changes waiting to be replayed point into the old string table
+    copySnapshot();
+    buffer.insert(buffer.end(), fileNames.begin(), fileNames.end());
+    const char* extentBytes = reinterpret_cast<const char*>(extents.data());
+    buffer.insert(buffer.end(), extentBytes, extentBytes + extents.size() * sizeof(lemlibExtent));
+    buffer.insert(buffer.end(), inlineData.begin(), inlineData.end());
+    header.stringTableSize = static_cast<uint32_t>(fileNames.size());
+    header.checksum =
+        crc32(buffer.data() + sizeof(header), buffer.size() - sizeof(header), crc32(&header, sizeof(header)));
+    memcpy(buffer.data(), &header, sizeof(header));
+    // write the index file
+    std::ofstream indexFile(INDEX_SLOTS[slot], std::ios_base::binary);
+    if (!indexFile.is_open()) throw CANNOT_OPEN_FILE(INDEX_SLOTS[slot]);
+    indexFile.write(buffer.data(), buffer.size());
+    indexFile.close();
+    if (!indexFile) throw CANNOT_OPEN_FILE(INDEX_SLOTS[slot]);
+    // only switch slots once the write is complete
+    activeSlot = slot;
+    indexGeneration = header.generation;
+    for (auto& container : containerFiles) {
+        container.second.committedLength = container.second.length;
+        container.second.committedExtents = container.second.extents.size();
+    }
+    for (auto& inlined : inlineFiles) {
+        inlined.second.committed = true;
+        inlined.second.journaled = false;
+    }
+    for (auto& reserved : reservedFiles) reserved.second.committedLength = reserved.second.length;
+}
+
+/**
+ * @brief Read a whole file with a single call
+ *
+ * @param path the path of the file
+ * @param buffer the buffer to read the file into
+ * @return true the file was read
+ * @return false the file does not exist or could not be read
+ */
+bool readWholeFile(const char* path, std::vector<char>& buffer) {
+    std::ifstream file(path, std::ios_base::binary | std::ios_base::ate);
+    if (!file.is_open()) return false;
+    const std::streamsize size = file.tellg();
+    file.seekg(0);
+    buffer.resize(size);
+    return static_cast<bool>(file.read(buffer.data(), size));
+}
+
+/**
+ * @brief Check the header and the checksum of an index file
+ *
+ * @param buffer the contents of the index file
+ * @param header the header of the index file, with a generation of 0 for version 1 files
+ * @return size_t the size of the header, or 0 if the index file is invalid
+ */
+size_t checkFileIndex(const std::vector<char>& buffer, lemlibIndexHeader& header) {
+    if (buffer.size() < INDEX_V1_HEADER_SIZE) return 0;
+    memcpy(&header, buffer.data(), INDEX_V1_HEADER_SIZE);
+    header.generation = 0;
+    size_t headerSize = INDEX_V1_HEADER_SIZE;
+    uint32_t checksum = 0;
+    if (header.version >= 2 && header.version <= INDEX_VERSION && buffer.size() >= sizeof(header)) {
+        // the header of newer versions is covered by the checksum too
+        memcpy(&header, buffer.data(), sizeof(header));
+        headerSize = sizeof(header);
+        lemlibIndexHeader copy = header;
+        copy.checksum = 0;
+        checksum = crc32(&copy, sizeof(copy));
+    } else if (header.version != 1) {
+        return 0;
+    }
+    const size_t recordSize = (header.version >= 3) ? sizeof(lemlibIndexRecord) : INDEX_V2_RECORD_SIZE;
+    const size_t recordsSize = size_t(header.recordCount) * recordSize;
+    if (header.magic != INDEX_MAGIC || header.recordSize != recordSize ||
+        buffer.size() < headerSize + recordsSize + header.stringTableSize)
+        return 0;
+    // the extent table holds the extents of all the records, followed by the contents of the inline files
+    size_t extentCount = 0;
+    size_t inlineSize = 0;
+    for (uint32_t i = 0; header.version >= 3 && i < header.recordCount; i++) {
+        lemlibIndexRecord entry;
+        memcpy(&entry, buffer.data() + headerSize + i * recordSize, sizeof(entry));
+        extentCount += entry.extentCount;
+        if (entry.flags & INDEX_INLINE) inlineSize += entry.length;
+    }
+    const size_t tablesSize = header.stringTableSize + extentCount * sizeof(lemlibExtent) + inlineSize;
+    if (buffer.size() != headerSize + recordsSize + tablesSize ||
+        header.checksum != crc32(buffer.data() + headerSize, buffer.size() - headerSize, checksum))
+        return 0;
+    return headerSize;
+}
+
+/**
+ * @brief Load a checked index file into the resident index
+ *
+ * The string table is kept as is, so no memory is allocated per entry.
+ *
+ * @param buffer the contents of the index file
+ * @param header the header of the index file
+ * @param headerSize the size of the header
+ * @param path the path of the index file, for error messages
+ */
+void loadFileIndex(const std::vector<char>& buffer, const lemlibIndexHeader& header, size_t headerSize,
+                   const char* path) {
+    const size_t recordSize = header.recordSize;
+    const size_t recordsSize = size_t(header.recordCount) * recordSize;
+    // copy the records and the string table
+    const char* record = buffer.data() + headerSize;
+    const char* extent = record + recordsSize + header.stringTableSize;
+    // the inline files follow the extents of all the records
+    const char* inlineData = extent;
+    for (uint32_t i = 0; recordSize == sizeof(lemlibIndexRecord) && i < header.recordCount; i++) {
+        lemlibIndexRecord entry;
+        memcpy(&entry, record + i * recordSize, sizeof(entry));
+        inlineData += entry.extentCount * sizeof(lemlibExtent);
+    }
+    fileNames.assign(record + recordsSize, header.stringTableSize);
+    fileIndex.clear();
+    fileIndex.reserve(header.recordCount);
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    std::lock_guard<pros::Mutex> inlineLock(inlineMutex);
+    std::lock_guard<pros::Mutex> reservedLock(reservedMutex);
+    containerFiles.clear();
+    inlineFiles.clear();
+    reservedFiles.clear();
+    for (uint32_t i = 0; i < header.recordCount; i++) {
+        // older records are shorter, the fields they lack are 0
+        lemlibIndexRecord entry = {};
+        memcpy(&entry, record, recordSize);
+        record += recordSize;
+        if (size_t(entry.nameOffset) + entry.nameLength > fileNames.size()) throw INDEX_CORRUPTED(path);
+        const uint16_t flags = entry.flags & INDEX_COMPRESSED;
+        fileIndex.push_back({entry.nameOffset, entry.nameLength, flags, entry.sector, 0});
+        fileIndex.back().hash = hashPath(pathKey(fileName(fileIndex.back())));
+        if (entry.flags & INDEX_INLINE) {
+            inlineFiles[entry.sector] = {std::string(inlineData, entry.length), true, false};
+            inlineData += entry.length;
+        }
+        if (entry.flags & INDEX_RESERVED) reservedFiles[entry.sector] = {entry.length, entry.length};
+        if ((entry.flags & INDEX_CONTAINER) == 0) continue;
+        lemlibContainerFile& file = containerFiles[entry.sector];
+        file.extents.resize(entry.extentCount);
+        memcpy(file.extents.data(), extent, entry.extentCount * sizeof(lemlibExtent));
+        extent += entry.extentCount * sizeof(lemlibExtent);
+        file.length = file.committedLength = entry.length;
+        file.committedExtents = entry.extentCount;
+    }
+}
 
 /**
- * @brief Exception class for the VFS
+ * @brief Convert a text index file from older versions into the resident index
  *
+ * Each line of the text index file is a path followed by a slash and the sector the file is stored in.
+ *
+ * @param indexFile the text index file
  */
-class VFSException : public std::exception {
-    public:
-        /**
-         * @brief Construct a new VFSException
-         *
-         * @param message the message to display when the exception is thrown
-         */
-        VFSException(const std::string& message) : m_message(message) {}
+void migrateTextIndex(std::ifstream& indexFile) {
+    fileIndex.clear();
+    fileNames.clear();
+    containerFiles.clear();
+    inlineFiles.clear();
+    reservedFiles.clear();
+    fileTable.assign(MIN_TABLE_SIZE, EMPTY_SLOT);
+    directories.assign(1, {0, "", {}, {}});
+    for (std::string line; std::getline(indexFile, line);) {
+        const size_t last_slash_pos = line.find_last_of("/");
+        if (last_slash_pos == std::string::npos) continue;
+        // split the line into the name and sector. The number after the last slash is the sector number
+        const std::string_view name = std::string_view(line).substr(0, last_slash_pos);
+        const char* first = line.data() + last_slash_pos + 1;
+        const char* last = line.data() + line.size();
+        uint32_t sector;
+        const auto [end, error] = std::from_chars(first, last, sector);
+        if (error != std::errc() || end != last || first == last) throw INDEX_CORRUPTED("/usd/index.txt");
+        if (findFile(name) == nullptr) insertFile(name, sector);
+    }
+}
 
-        /**
-         * @brief Get the message of the exception
-         *
-         * @return const char* the message
-         */
-        const char* what() const noexcept override { return m_message.c_str(); }
-    private:
-        std::string m_message;
-};
+/**
+ * @brief Apply a reserve or length record to a reserved sector file
+ *
+ * @param sector the sector of the file
+ * @param length the length the record is followed by
+ * @param reserve whether the record reserves space for the file, instead of only recording its length
+ * @return true the record was applied
+ * @return false the record is not a reservation and the file has no space reserved
+ */
+bool applyReservedLength(uint32_t sector, std::string_view length, bool reserve) {
+    if (length.size() != sizeof(uint32_t)) return false;
+    std::lock_guard<pros::Mutex> lock(reservedMutex);
+    const auto reserved = reservedFiles.find(sector);
+    if (reserved == reservedFiles.end() && !reserve) return false;
+    // only the newest length is alive
+    if (reserved != reservedFiles.end()) deadRecords++;
+    lemlibReservedFile& file = reservedFiles[sector];
+    memcpy(&file.length, length.data(), sizeof(uint32_t));
+    file.committedLength = file.length;
+    return true;
+}
 
 /**
- * @brief Structure for an entry in the index file
+ * @brief Apply a journal record to the resident index
+ *
+ * Applying a record that is already reflected in the index has no effect, so replaying a journal that was compacted
+ * into the index file just before a brown out is harmless.
  *
- * @param name the name of the file
+ * @param type the kind of change
+ * @param flags the flags of the record
  * @param sector the sector the file is stored in
+ * @param name the normalized path of the file, or the extent or length of extent, length and reserve records
+ * @param newName the new normalized path of the file if the record is a rename
  */
-typedef struct lemlibFile {
-        std::string name;
-        std::string sector;
+void applyJournalRecord(uint8_t type, uint8_t flags, uint32_t sector, std::string_view name,
+                        std::string_view newName) {
+    const bool bySector = type == JOURNAL_EXTENT || type == JOURNAL_LENGTH || type == JOURNAL_DATA ||
+                          type == JOURNAL_PROMOTE || type == JOURNAL_RESERVE;
+    const lemlibFile* file = bySector ? nullptr : findFile(name);
+    switch (type) {
+        case JOURNAL_CREATE:
+            if (file != nullptr) deadRecords += deleteEntry(name) + 1;
+            insertFile(name, sector, (flags & JOURNAL_COMPRESSED) ? INDEX_COMPRESSED : 0);
+            if (flags & JOURNAL_CONTAINER) {
+                std::lock_guard<pros::Mutex> lock(containerMutex);
+                containerFiles[sector] = {0, {}, 0, 0};
+            }
+            if (flags & JOURNAL_INLINE) {
+                std::lock_guard<pros::Mutex> lock(inlineMutex);
+                inlineFiles[sector] = {"", true, false};
+            }
+            break;
+        case JOURNAL_DELETE:
+            if (file == nullptr) break;
+            // the tombstone and the record it replaces are both dead
+            deadRecords += deleteEntry(name) + 2;
+            break;
+        case JOURNAL_RENAME: {
+            if (file == nullptr) break;
+            sector = file->sector;
+            const uint16_t fileFlags = file->flags;
+            if (findFile(newName) != nullptr) deadRecords += deleteEntry(newName) + 1;
+            removeFile(name);
+            insertFile(newName, sector, fileFlags);
+            deadRecords++;
+            break;
+        }
+        case JOURNAL_RESERVE:
+            applyReservedLength(sector, name, true);
+            break;
+        case JOURNAL_LENGTH:
+            // length records describe reserved sector files too
+            if (applyReservedLength(sector, name, false)) break;
+            [[fallthrough]];
+        case JOURNAL_EXTENT: {
+            std::lock_guard<pros::Mutex> lock(containerMutex);
+            const auto container = containerFiles.find(sector);
+            if (container == containerFiles.end()) break;
+            lemlibContainerFile& entry = container->second;
+            if (type == JOURNAL_LENGTH && name.size() == sizeof(uint32_t)) {
+                // only the newest length is alive
+                if (entry.committedLength != 0) deadRecords++;
+                memcpy(&entry.length, name.data(), sizeof(uint32_t));
+                entry.committedLength = entry.length;
+            } else if (type == JOURNAL_EXTENT && name.size() == sizeof(lemlibExtent)) {
+                lemlibExtent extent;
+                memcpy(&extent, name.data(), sizeof(extent));
+                // the extent may already be in the index file if the journal was compacted just before a brown out
+                if (std::any_of(entry.extents.begin(), entry.extents.end(), [&](const lemlibExtent& other) {
+                        return other.firstBlock == extent.firstBlock;
+                    }))
+                    break;
+                entry.extents.push_back(extent);
+                entry.committedExtents = entry.extents.size();
+                markBlocks(extent, true);
+            }
+            break;
+        }
+        case JOURNAL_DATA:
+        case JOURNAL_PROMOTE: {
+            std::lock_guard<pros::Mutex> lock(inlineMutex);
+            const auto inlined = inlineFiles.find(sector);
+            if (inlined == inlineFiles.end()) break;
+            // only the newest data record is alive
+            if (inlined->second.journaled) deadRecords++;
+            if (type == JOURNAL_DATA) inlined->second = {std::string(name), true, true};
+            else inlineFiles.erase(inlined);
+            break;
+        }
+    }
+    totalRecords++;
+}
 
-        lemlibFile(const std::string& name_, const std::string& sector_) : name(name_), sector(sector_) {}
-} lemlibFile;
+/**
+ * @brief Check a record of the index journal
+ *
+ * @param buffer the contents of the journal
+ * @param offset the offset of the record
+ * @param record the header of the record
+ * @return size_t the size of the record, or 0 if it is torn
+ */
+size_t readJournalRecord(const std::vector<char>& buffer, size_t offset, lemlibJournalRecord& record) {
+    if (offset + sizeof(lemlibJournalRecord) > buffer.size()) return 0;
+    memcpy(&record, buffer.data() + offset, sizeof(record));
+    const size_t recordSize = sizeof(record) + record.nameLength + record.newNameLength;
+    if (offset + recordSize > buffer.size()) return 0;
+    // verify the checksum of the record
+    lemlibJournalRecord header = record;
+    header.checksum = 0;
+    const uint32_t actual =
+        crc32(buffer.data() + offset + sizeof(record), recordSize - sizeof(record), crc32(&header, sizeof(header)));
+    return (actual == record.checksum) ? recordSize : 0;
+}
+
+/**
+ * @brief Apply a checked record of the index journal to the resident index
+ *
+ * @param buffer the contents of the journal
+ * @param offset the offset of the record
+ * @param record the header of the record
+ */
+void replayJournalRecord(const std::vector<char>& buffer, size_t offset, const lemlibJournalRecord& record) {
+    const char* name = buffer.data() + offset + sizeof(record);
+    applyJournalRecord(record.type, record.flags, record.sector, std::string_view(name, record.nameLength),
+                       std::string_view(name + record.nameLength, record.newNameLength));
+}
+
+/**
+ * @brief Replay the index journal on top of the resident index
+ *
+ * Replay stops at the first invalid record, which can only be the last one written before a brown out. A batch is
+ * dropped as a whole if any of its records is invalid. A journal that belongs to an older generation of the index
+ * file is skipped, since its changes were compacted into the newer index file before a brown out could reset it.
+ *
+ * @param legacy whether the index was loaded from a version 1 index file, whose journal has no generation record
+ * @return true the whole journal was valid and can be appended to
+ * @return false the journal is missing, stale or ends with a torn record, and has to be reset
+ */
+bool replayJournal(bool legacy) {
+    std::vector<char> buffer;
+    if (!readWholeFile("/usd/index.log", buffer)) return false;
+    size_t offset = 0;
+    if (!legacy) {
+        lemlibJournalRecord record;
+        const size_t recordSize = readJournalRecord(buffer, offset, record);
+        if (recordSize == 0 || record.type != JOURNAL_GENERATION || record.sector != indexGeneration) return false;
+        offset += recordSize;
+    }
+    while (offset < buffer.size()) {
+        lemlibJournalRecord record;
+        const size_t recordSize = readJournalRecord(buffer, offset, record);
+        if (recordSize == 0) return false;
+        if (record.type != JOURNAL_BATCH) {
+            replayJournalRecord(buffer, offset, record);
+            offset += recordSize;
+            continue;
+        }
+        totalRecords++;
+        deadRecords++;
+        // check every record of the batch before applying any of them
+        size_t end = offset + recordSize;
+        for (uint32_t i = 0; i < record.sector; i++) {
+            lemlibJournalRecord batched;
+            const size_t batchedSize = readJournalRecord(buffer, end, batched);
+            if (batchedSize == 0) return false;
+            end += batchedSize;
+        }
+        for (offset += recordSize; offset < end;) {
+            lemlibJournalRecord batched;
+            const size_t batchedSize = readJournalRecord(buffer, offset, batched);
+            replayJournalRecord(buffer, offset, batched);
+            offset += batchedSize;
+        }
+    }
+    return !legacy;
+}
+
+/**
+ * @brief Encode a record of the index journal
+ *
+ * @param buffer the buffer to add the record to
+ * @param type the kind of change
+ * @param sector the sector the file is stored in, or the number of records in a batch
+ * @param name the normalized path of the file, or the extent or length of extent, length and reserve records
+ * @param newName the new normalized path of the file if the record is a rename
+ * @param flags the flags of the record
+ */
+void encodeJournalRecord(std::vector<char>& buffer, uint8_t type, uint32_t sector, std::string_view name,
+                         std::string_view newName = "", uint8_t flags = 0) {
+    lemlibJournalRecord record = {
+        type, flags, static_cast<uint16_t>(name.size()), static_cast<uint16_t>(newName.size()), 0, sector, 0};
+    record.checksum = crc32(&record, sizeof(record));
+    record.checksum = crc32(newName.data(), newName.size(), crc32(name.data(), name.size(), record.checksum));
+    const size_t offset = buffer.size();
+    buffer.resize(offset + sizeof(record));
+    memcpy(buffer.data() + offset, &record, sizeof(record));
+    buffer.insert(buffer.end(), name.begin(), name.end());
+    buffer.insert(buffer.end(), newName.begin(), newName.end());
+}
+
+/**
+ * @brief Write encoded records to the index journal
+ *
+ * @param buffer the encoded records, written with a single call
+ */
+void writeJournal(const std::vector<char>& buffer) {
+    journalFile.write(buffer.data(), buffer.size());
+    journalFile.flush();
+    if (!journalFile) throw CANNOT_OPEN_FILE("/usd/index.log");
+}
+
+/**
+ * @brief Append a record to the index journal
+ *
+ * @param type the kind of change
+ * @param sector the sector the file is stored in
+ * @param name the normalized path of the file
+ * @param newName the new normalized path of the file if the record is a rename
+ * @param flags the flags of the record
+ */
+void appendJournal(uint8_t type, uint32_t sector, std::string_view name, std::string_view newName = "",
+                   uint8_t flags = 0) {
+    std::vector<char> buffer;
+    encodeJournalRecord(buffer, type, sector, name, newName, flags);
+    writeJournal(buffer);
+    totalRecords++;
+}
+
+/**
+ * @brief Write the resident index to the index file and empty the journal
+ *
+ */
+void compactFileIndex() {
+    writeFileIndex();
+    // start a new journal for the new generation of the index file
+    journalFile.close();
+    journalFile.open("/usd/index.log", std::ios_base::binary | std::ios_base::trunc);
+    if (!journalFile.is_open()) throw CANNOT_OPEN_FILE("/usd/index.log");
+    std::vector<char> buffer;
+    encodeJournalRecord(buffer, JOURNAL_GENERATION, indexGeneration, "");
+    writeJournal(buffer);
+    totalRecords = fileIndex.size();
+    deadRecords = 0;
+}
+
+/**
+ * @brief Check if too many of the records of the journal are dead
+ *
+ */
+bool compactionDue() {
+    return totalRecords >= COMPACTION_MIN_RECORDS && deadRecords > totalRecords * COMPACTION_DEAD_RATIO;
+}
+
+/**
+ * @brief Queue a compaction of the journal to the VFS I/O task if too many of the records are dead
+ *
+ * Compacting rewrites the whole index file, so the change that made the journal too dead does not wait for it.
+ */
+void compactIfNeeded() {
+    if (compactionQueued || !compactionDue()) return;
+    compactionQueued = true;
+    lemlib::fs::queueCompaction();
+}
+
+void compactQueuedIndex() {
+    IndexWriteLock indexLock;
+    compactionQueued = false;
+    // the journal may have been compacted or reloaded since, and a failed compaction is retried after the next change
+    if (vfsInitialized && compactionDue()) compactFileIndex();
+}
+
+/**
+ * @brief Get the path of the real file a sector is stored in
+ *
+ * @param sector the sector
+ * @return std::string the path of the sector file
+ */
+std::string getSectorPath(uint32_t sector) { return "/usd/" + std::to_string(sector); }
 
 /**
  * @brief Initialize the file system
  *
+ * Loads the newest valid index slot into memory and replays the index journal on top of it. Calling it again has no
+ * effect, use reloadVFS() to re-read the index. Index files from older versions (/usd/index.bin, or the text index
+ * /usd/index.txt) are converted when no index slot exists yet. The text index is renamed to /usd/index.txt.old.
+ *
+ * @param cacheSize the RAM budget of the block cache in bytes, 0 to disable it
  */
-void initVFS() {
-    // Check if the index file exists
-    std::ifstream indexFile("/usd/index.txt");
-    // If the index file does not exist, create it
-    if (!indexFile.is_open()) {
-        std::ofstream newIndexFile("/usd/index.txt");
-        // throw an exception if the index file could not be created
-        if (!newIndexFile.is_open()) throw VFS_INIT_FAILED;
-        indexFile.close();
+void initVFS(size_t cacheSize) {
+    IndexWriteLock indexLock;
+    if (vfsInitialized) return;
+    discardSnapshotChanges();
+    lemlib::fs::configureCache(cacheSize);
+    // read both slots and pick the valid one with the highest generation
+    std::vector<char> slots[2];
+    lemlibIndexHeader headers[2];
+    size_t headerSizes[2] = {0, 0};
+    bool slotExists = false;
+    int best = -1;
+    for (int i = 0; i < 2; i++) {
+        if (!readWholeFile(INDEX_SLOTS[i], slots[i])) continue;
+        slotExists = true;
+        headerSizes[i] = checkFileIndex(slots[i], headers[i]);
+        if (headerSizes[i] == 0 || headers[i].version < 2) continue;
+        if (best == -1 || headers[i].generation > headers[best].generation) best = i;
+    }
+    bool legacy = false;
+    std::ifstream textIndexFile;
+    if (best != -1) {
+        loadFileIndex(slots[best], headers[best], headerSizes[best], INDEX_SLOTS[best]);
+        activeSlot = best;
+        indexGeneration = headers[best].generation;
+    } else {
+        // fall back to the index files of older versions
+        legacy = true;
+        activeSlot = -1;
+        indexGeneration = 0;
+        std::vector<char> buffer;
+        lemlibIndexHeader header;
+        textIndexFile.open("/usd/index.txt");
+        if (readWholeFile("/usd/index.bin", buffer)) {
+            const size_t headerSize = checkFileIndex(buffer, header);
+            if (headerSize == 0) throw INDEX_CORRUPTED("/usd/index.bin");
+            loadFileIndex(buffer, header, headerSize, "/usd/index.bin");
+        } else if (textIndexFile.is_open()) {
+            migrateTextIndex(textIndexFile);
+        } else if (slotExists) {
+            // never start over with an empty index if there was one
+            throw INDEX_CORRUPTED(INDEX_SLOTS[0]);
+        } else {
+            fileIndex.clear();
+            fileNames.clear();
+            containerFiles.clear();
+            inlineFiles.clear();
+            reservedFiles.clear();
+        }
+    }
+    rebuildLookups();
+    totalRecords = fileIndex.size();
+    deadRecords = 0;
+    // apply the changes made since the index file was last written
+    const bool journalValid = replayJournal(legacy);
+    journalFile.close();
+    journalFile.open("/usd/index.log", std::ios_base::binary | std::ios_base::app);
+    if (!journalFile.is_open()) throw VFS_INIT_FAILED;
+    vfsInitialized = true;
+    // a torn or stale journal would hide everything appended after it, so get rid of it now
+    if (!journalValid) {
+        try {
+            compactFileIndex();
+        } catch (const VFSException&) {
+            vfsInitialized = false;
+            // throw an exception if the index file could not be created
+            throw VFS_INIT_FAILED;
+        }
+    }
+    // make sure the index files of older versions are not converted again
+    if (legacy) {
+        std::remove("/usd/index.bin");
+        if (textIndexFile.is_open()) {
+            textIndexFile.close();
+            std::rename("/usd/index.txt", "/usd/index.txt.old");
+        }
     }
 }
 
 /**
- * @brief Read the index file
+ * @brief Compact the index journal into the index file
  *
- * @return std::vector<lemlibFile> contents of the index file
+ * This happens automatically on the VFS I/O task once enough of the journal is dead, which holds up other changes to
+ * the index while it runs. It can be called when the robot is idle to avoid paying for it during a match.
  */
-std::vector<lemlibFile> readFileIndex() {
-    // iterate through the index file
-    std::ifstream indexFile("/usd/index.txt");
-    if (!indexFile) throw CANNOT_OPEN_FILE("/usd/index.txt");
-    std::vector<lemlibFile> index;
-    for (std::string line; std::getline(indexFile, line);) {
-        const size_t last_slash_pos = line.find_last_of("/");
-        // split the line into the name and sector. The number after the last slash is the sector number
-        index.emplace_back(line.substr(0, last_slash_pos), line.substr(last_slash_pos + 1));
+void compactVFS() {
+    IndexWriteLock indexLock;
+    if (!vfsInitialized) throw VFS_NOT_INITIALIZED;
+    compactFileIndex();
+}
+
+/**
+ * @brief Discard the resident index and read the index file again
+ *
+ * Only needed if the index file was modified by something other than the VFS.
+ */
+void reloadVFS() {
+    IndexWriteLock indexLock;
+    vfsInitialized = false;
+    // lookups fail until the index is loaded again
+    publishSnapshot();
+    fileIndex.clear();
+    fileNames.clear();
+    fileTable.clear();
+    sectorBitmap.clear();
+    directories.clear();
+    {
+        std::lock_guard<pros::Mutex> lock(containerMutex);
+        containerFiles.clear();
+        containers.clear();
+    }
+    {
+        std::lock_guard<pros::Mutex> lock(inlineMutex);
+        inlineFiles.clear();
+    }
+    {
+        std::lock_guard<pros::Mutex> lock(reservedMutex);
+        reservedFiles.clear();
+    }
+    // keep the budget of the cache, but not its contents
+    lemlib::fs::clearCache();
+    initVFS(lemlib::fs::getCacheStats().capacity);
+}
+
+/**
+ * @brief Look up the sector of a virtual file without allocating
+ *
+ * @param path the path of the virtual file
+ * @param sector set to the sector the file is stored in if it is found
+ * @return true the file was found
+ * @return false the file does not exist
+ */
+bool lookupFileSector(std::string_view path, uint32_t& sector) {
+    const SnapshotReference snapshot;
+    const lemlibFile* file = snapshot.findFile(path);
+    if (file == nullptr) return false;
+    sector = file->sector;
+    return true;
+}
+
+/**
+ * @brief Look up the sector of a virtual file, creating the file if it does not exist
+ *
+ * Both happen under the same lock, so another task cannot create the file in between.
+ *
+ * @param path the path of the virtual file
+ * @return uint32_t the sector the file is stored in
+ */
+uint32_t findOrCreateFile(std::string_view path) {
+    IndexWriteLock indexLock;
+    if (!vfsInitialized) throw VFS_NOT_INITIALIZED;
+    if (findFile(path) == nullptr) createFile(path, false);
+    return findFile(path)->sector;
+}
+
+/**
+ * @brief Check if a virtual file is compressed
+ *
+ * @param path the path of the virtual file
+ * @return true the file is compressed
+ * @return false the file is not compressed or does not exist
+ */
+bool isCompressedFile(std::string_view path) {
+    const SnapshotReference snapshot;
+    const lemlibFile* file = snapshot.findFile(path);
+    return file != nullptr && (file->flags & INDEX_COMPRESSED);
+}
+
+/**
+ * @brief Check if a file is stored in the containers
+ *
+ * @param sector the sector of the file
+ * @return true the file is a container file
+ * @return false the file is a sector file or does not exist
+ */
+bool isContainerFile(uint32_t sector) {
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    return containerFiles.count(sector) != 0;
+}
+
+/**
+ * @brief Get the length of a container file
+ *
+ * @param sector the sector of the file
+ * @param length set to the length of the file in bytes if it is a container file
+ * @return true the file is a container file
+ * @return false the file is a sector file or does not exist
+ */
+bool getContainerLength(uint32_t sector, size_t& length) {
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    const auto container = containerFiles.find(sector);
+    if (container == containerFiles.end()) return false;
+    length = container->second.length;
+    return true;
+}
+
+/**
+ * @brief Read from a container file
+ *
+ * @param sector the sector of the file
+ * @param offset where to start reading
+ * @param data where to store the bytes read
+ * @param size the number of bytes to read
+ * @return size_t the number of bytes read, 0 at the end of the file or if the containers could not be read
+ */
+size_t readContainer(uint32_t sector, size_t offset, void* data, size_t size) {
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    const auto container = containerFiles.find(sector);
+    if (container == containerFiles.end() || offset >= container->second.length) return 0;
+    size = std::min(size, container->second.length - offset);
+    try {
+        return transferContainer(container->second, offset, static_cast<char*>(data), size, false) ? size : 0;
+    } catch (const VFSException&) {
+        return 0;
+    }
+}
+
+/**
+ * @brief Write to a container file, allocating blocks as needed
+ *
+ * The new blocks and length are only recorded in the journal by commitContainer().
+ *
+ * @param sector the sector of the file
+ * @param offset where to start writing
+ * @param data the bytes to write
+ * @param size the number of bytes to write
+ * @return true the bytes were written
+ * @return false the file does not exist or the containers could not be written
+ */
+bool writeContainer(uint32_t sector, size_t offset, const void* data, size_t size) {
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    const auto container = containerFiles.find(sector);
+    if (container == containerFiles.end()) return false;
+    lemlibContainerFile& file = container->second;
+    try {
+        allocateBlocks(file, (offset + size + CONTAINER_BLOCK_SIZE - 1) / CONTAINER_BLOCK_SIZE);
+        // blocks may hold data of deleted files, so a write past the end fills the gap with zeros
+        static char zeros[CONTAINER_BLOCK_SIZE] = {};
+        while (file.length < offset) {
+            const size_t n = std::min(offset - file.length, sizeof(zeros));
+            if (!transferContainer(file, file.length, zeros, n, true)) return false;
+            file.length += n;
+        }
+        if (!transferContainer(file, offset, const_cast<char*>(static_cast<const char*>(data)), size, true))
+            return false;
+    } catch (const VFSException&) {
+        return false;
+    }
+    file.length = std::max(file.length, static_cast<uint32_t>(offset + size));
+    return true;
+}
+
+/**
+ * @brief Empty a container file, keeping its blocks for the data written next
+ *
+ * @param sector the sector of the file
+ */
+void truncateContainer(uint32_t sector) {
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    const auto container = containerFiles.find(sector);
+    if (container != containerFiles.end()) container->second.length = 0;
+}
+
+/**
+ * @brief Record the blocks and the length of a container file in the journal
+ *
+ * @param sector the sector of the file
+ */
+void commitContainer(uint32_t sector) {
+    IndexWriteLock indexLock;
+    std::vector<char> buffer;
+    uint32_t length;
+    size_t extents;
+    size_t records = 0;
+    {
+        std::lock_guard<pros::Mutex> lock(containerMutex);
+        const auto container = containerFiles.find(sector);
+        if (container == containerFiles.end()) return;
+        const lemlibContainerFile& file = container->second;
+        length = file.length;
+        extents = file.extents.size();
+        for (size_t i = file.committedExtents; i < extents; i++, records++) {
+            const char* extent = reinterpret_cast<const char*>(&file.extents[i]);
+            encodeJournalRecord(buffer, JOURNAL_EXTENT, sector, std::string_view(extent, sizeof(lemlibExtent)));
+        }
+        if (length != file.committedLength) {
+            encodeJournalRecord(buffer, JOURNAL_LENGTH, sector,
+                                std::string_view(reinterpret_cast<const char*>(&length), sizeof(length)));
+            if (file.committedLength != 0) deadRecords++;
+            records++;
+        }
+    }
+    if (records == 0) return;
+    writeJournal(buffer);
+    totalRecords += records;
+    std::lock_guard<pros::Mutex> lock(containerMutex);
+    const auto container = containerFiles.find(sector);
+    if (container == containerFiles.end()) return;
+    container->second.committedLength = length;
+    container->second.committedExtents = extents;
+}
+
+/**
+ * @brief Check if a file is stored in the index
+ *
+ * @param sector the sector of the file
+ * @return true the file is an inline file
+ * @return false the file is stored elsewhere or does not exist
+ */
+bool isInlineFile(uint32_t sector) {
+    std::lock_guard<pros::Mutex> lock(inlineMutex);
+    return inlineFiles.count(sector) != 0;
+}
+
+/**
+ * @brief Get the length of an inline file
+ *
+ * @param sector the sector of the file
+ * @param length set to the length of the file in bytes if it is an inline file
+ * @return true the file is an inline file
+ * @return false the file is stored elsewhere or does not exist
+ */
+bool getInlineLength(uint32_t sector, size_t& length) {
+    std::lock_guard<pros::Mutex> lock(inlineMutex);
+    const auto inlined = inlineFiles.find(sector);
+    if (inlined == inlineFiles.end()) return false;
+    length = inlined->second.data.size();
+    return true;
+}
+
+/**
+ * @brief Read from an inline file
+ *
+ * @param sector the sector of the file
+ * @param offset where to start reading
+ * @param data where to store the bytes read
+ * @param size the number of bytes to read
+ * @return size_t the number of bytes read, 0 at the end of the file
+ */
+size_t readInline(uint32_t sector, size_t offset, void* data, size_t size) {
+    std::lock_guard<pros::Mutex> lock(inlineMutex);
+    const auto inlined = inlineFiles.find(sector);
+    if (inlined == inlineFiles.end() || offset >= inlined->second.data.size()) return 0;
+    return inlined->second.data.copy(static_cast<char*>(data), size, offset);
+}
+
+/**
+ * @brief Write to an inline file
+ *
+ * The contents are only recorded in the journal by commitInline().
+ *
+ * @param sector the sector of the file
+ * @param offset where to start writing
+ * @param data the bytes to write
+ * @param size the number of bytes to write
+ * @return true the bytes were written
+ * @return false the file is not an inline file
+ */
+bool writeInline(uint32_t sector, size_t offset, const void* data, size_t size) {
+    std::lock_guard<pros::Mutex> lock(inlineMutex);
+    const auto inlined = inlineFiles.find(sector);
+    if (inlined == inlineFiles.end()) return false;
+    // like a sector file, an empty write past the end does not extend the file
+    if (size == 0) return true;
+    std::string& contents = inlined->second.data;
+    if (contents.size() < offset + size) contents.resize(offset + size, '\0');
+    contents.replace(offset, size, static_cast<const char*>(data), size);
+    inlined->second.committed = false;
+    return true;
+}
+
+/**
+ * @brief Empty an inline file
+ *
+ * @param sector the sector of the file
+ */
+void truncateInline(uint32_t sector) {
+    std::lock_guard<pros::Mutex> lock(inlineMutex);
+    const auto inlined = inlineFiles.find(sector);
+    if (inlined == inlineFiles.end() || inlined->second.data.empty()) return;
+    inlined->second.data.clear();
+    inlined->second.committed = false;
+}
+
+/**
+ * @brief Record the contents of an inline file in the journal
+ *
+ * Each record holds the whole contents, so the journal is compacted if too much of it is dead afterwards.
+ *
+ * @param sector the sector of the file
+ */
+void commitInline(uint32_t sector) {
+    IndexWriteLock indexLock;
+    std::vector<char> buffer;
+    std::string data;
+    {
+        std::lock_guard<pros::Mutex> lock(inlineMutex);
+        const auto inlined = inlineFiles.find(sector);
+        if (inlined == inlineFiles.end() || inlined->second.committed) return;
+        data = inlined->second.data;
+    }
+    encodeJournalRecord(buffer, JOURNAL_DATA, sector, data);
+    writeJournal(buffer);
+    totalRecords++;
+    {
+        std::lock_guard<pros::Mutex> lock(inlineMutex);
+        const auto inlined = inlineFiles.find(sector);
+        if (inlined == inlineFiles.end()) return;
+        if (inlined->second.journaled) deadRecords++;
+        inlined->second.journaled = true;
+        // the write-behind task may have written to the file in the meantime
+        inlined->second.committed = inlined->second.data == data;
+    }
+    compactIfNeeded();
+}
+
+/**
+ * @brief Turn an inline file into a sector file holding the same contents
+ *
+ * The sector file is written before the promotion is recorded in the journal, so a brown out in between leaves the
+ * file inline.
+ *
+ * @param sector the sector of the file
+ */
+void promoteInlineFile(uint32_t sector) {
+    IndexWriteLock indexLock;
+    std::string data;
+    {
+        std::lock_guard<pros::Mutex> lock(inlineMutex);
+        const auto inlined = inlineFiles.find(sector);
+        if (inlined == inlineFiles.end()) return;
+        data = inlined->second.data;
+    }
+    const std::string path = getSectorPath(sector);
+    std::ofstream sectorFile(path, std::ios_base::binary | std::ios_base::trunc);
+    sectorFile.write(data.data(), data.size());
+    sectorFile.close();
+    if (!sectorFile) throw CANNOT_WRITE_FILE(path);
+    appendJournal(JOURNAL_PROMOTE, sector, "");
+    deadRecords += freeInlineFile(sector);
+}
+
+/**
+ * @brief Get the length of a reserved sector file
+ *
+ * @param sector the sector of the file
+ * @param length set to the length of the data in bytes if the file has space reserved
+ * @return true the file has space reserved
+ * @return false the file has no space reserved or does not exist
+ */
+bool getReservedLength(uint32_t sector, size_t& length) {
+    std::lock_guard<pros::Mutex> lock(reservedMutex);
+    const auto reserved = reservedFiles.find(sector);
+    if (reserved == reservedFiles.end()) return false;
+    length = reserved->second.length;
+    return true;
+}
+
+/**
+ * @brief Extend the length of a reserved sector file after a write
+ *
+ * The new length is only recorded in the journal by commitReserved().
+ *
+ * @param sector the sector of the file
+ * @param end the end of the write
+ */
+void extendReserved(uint32_t sector, size_t end) {
+    std::lock_guard<pros::Mutex> lock(reservedMutex);
+    const auto reserved = reservedFiles.find(sector);
+    if (reserved != reservedFiles.end() && reserved->second.length < end)
+        reserved->second.length = static_cast<uint32_t>(end);
+}
+
+/**
+ * @brief Empty a reserved sector file, keeping its space for the data written next
+ *
+ * @param sector the sector of the file
+ */
+void truncateReserved(uint32_t sector) {
+    std::lock_guard<pros::Mutex> lock(reservedMutex);
+    const auto reserved = reservedFiles.find(sector);
+    if (reserved != reservedFiles.end()) reserved->second.length = 0;
+}
+
+/**
+ * @brief Record the length of a reserved sector file in the journal
+ *
+ * A log flushed often adds a record each time, so the journal is compacted if too much of it is dead afterwards.
+ *
+ * @param sector the sector of the file
+ */
+void commitReserved(uint32_t sector) {
+    IndexWriteLock indexLock;
+    uint32_t length;
+    {
+        std::lock_guard<pros::Mutex> lock(reservedMutex);
+        const auto reserved = reservedFiles.find(sector);
+        if (reserved == reservedFiles.end() || reserved->second.length == reserved->second.committedLength) return;
+        length = reserved->second.length;
+    }
+    appendJournal(JOURNAL_LENGTH, sector, std::string_view(reinterpret_cast<const char*>(&length), sizeof(length)));
+    deadRecords++;
+    {
+        std::lock_guard<pros::Mutex> lock(reservedMutex);
+        const auto reserved = reservedFiles.find(sector);
+        if (reserved != reservedFiles.end()) reserved->second.committedLength = length;
+    }
+    compactIfNeeded();
+}
+
+/**
+ * @brief Grow the sector file of a file to reserve space after its data, and record the reservation
+ *
+ * The space is filled with zeros, which makes the FAT allocate its clusters now instead of during later writes. The
+ * sector file is never shrunk, and the length of a file that has space reserved already is kept.
+ *
+ * @param sector the sector of the file
+ * @param bytes the size the sector file must have
+ */
+void reserveSectorFile(uint32_t sector, size_t bytes) {
+    const std::string path = getSectorPath(sector);
+    size_t length;
+    const bool reserved = getReservedLength(sector, length);
+    // create the sector file first if it does not exist, without emptying it if it does
+    std::ofstream(path, std::ios_base::app | std::ios_base::binary);
+    std::fstream sectorFile(path, std::ios_base::in | std::ios_base::out | std::ios_base::binary | std::ios_base::ate);
+    if (!sectorFile.is_open()) throw CANNOT_OPEN_FILE(path);
+    size_t size = static_cast<size_t>(sectorFile.tellp());
+    // the data of a file reserved for the first time is the whole sector file
+    if (!reserved) length = size;
+    static const char zeros[CONTAINER_BLOCK_SIZE] = {};
+    while (size < bytes) {
+        const size_t n = std::min(bytes - size, sizeof(zeros));
+        sectorFile.write(zeros, n);
+        size += n;
+    }
+    sectorFile.close();
+    if (!sectorFile) throw CANNOT_WRITE_FILE(path);
+    if (reserved) return;
+    const uint32_t recorded = static_cast<uint32_t>(length);
+    appendJournal(JOURNAL_RESERVE, sector,
+                  std::string_view(reinterpret_cast<const char*>(&recorded), sizeof(recorded)));
+    std::lock_guard<pros::Mutex> lock(reservedMutex);
+    reservedFiles[sector] = {recorded, recorded};
+}
+
+namespace lemlib {
+namespace fs {
+void setDefaultStorage(Storage storage) { defaultStorage = storage; }
+
+Storage getDefaultStorage() { return defaultStorage; }
+
+void setDefaultCompression(bool enabled) { defaultCompression = enabled; }
+
+bool getDefaultCompression() { return defaultCompression; }
+
+void setInlineThreshold(size_t bytes) { inlineThreshold = std::min(bytes, MAX_INLINE_THRESHOLD); }
+
+size_t getInlineThreshold() { return inlineThreshold; }
+
+void reserve(std::string_view path, size_t bytes) {
+    IndexWriteLock indexLock;
+    const uint32_t sector = findOrCreateFile(path);
+    if (isContainerFile(sector)) {
+        // container files reserve blocks, which are recorded as extents right away
+        {
+            std::lock_guard<pros::Mutex> lock(containerMutex);
+            allocateBlocks(containerFiles[sector], (bytes + CONTAINER_BLOCK_SIZE - 1) / CONTAINER_BLOCK_SIZE);
+        }
+        commitContainer(sector);
+        return;
     }
-    return index;
+    // space is reserved for a file that will grow, so an inline file is moved to its sector file right away
+    promoteInlineFile(sector);
+    reserveSectorFile(sector, bytes);
 }
+} // namespace fs
+} // namespace lemlib
 
 /**
  * @brief Get the sector of a virtual file
  *
+ * Does not allocate any memory, sector numbers always fit in the small string buffer.
+ *
  * @param path the path of the virtual file
  * @return std::string the sector the file is stored in, or null if the file is not found
  */
-std::string getFileSector(const std::string& path) {
-    // If the path does not start with a slash, add one
-    const std::string corrected_path = (path.front() == '/') ? path : ('/' + path);
-    // Iterate through the index
-    const std::vector<lemlibFile> index = readFileIndex();
-    const std::vector<lemlibFile>::const_iterator it =
-        std::find_if(index.begin(), index.end(), [&](const lemlibFile& file) { return file.name == corrected_path; });
+std::string getFileSector(std::string_view path) {
+    const SnapshotReference snapshot;
+    // Look the file up in the index
+    const lemlibFile* file = snapshot.findFile(path);
     // return the sector if the file is found, or an empty string if it is not found
-    return (it != index.end()) ? it->sector : "";
+    return (file != nullptr) ? std::to_string(file->sector) : "";
 }
 
 /**
  * @brief List all the files and folders in a directory
  *
+ * Directories are listed with a trailing slash. With recursion enabled, the paths of all the files below the directory
+ * are listed instead, relative to it. Listing only visits the part of the directory tree being listed.
+ *
  * @param dir the directory to list
+ * @param recursive whether to list the files in subdirectories as well
  * @return std::vector <std::string> a vector of all the files and folders in the directory
  */
-std::vector<std::string> listDirectory(const std::string& dir, bool recursive = false) {
-    // If the path does not start with a slash, add one
-    const std::string corrected_dir = (dir.front() == '/') ? dir : ('/' + dir);
+std::vector<std::string> listDirectory(std::string_view dir, bool recursive) {
+    lemlib::fs::SharedLock indexLock(indexMutex);
+    if (!vfsInitialized) throw VFS_NOT_INITIALIZED;
     std::vector<std::string> files;
-    // Iterate through all the files in the index
-    for (const lemlibFile& line : readFileIndex()) {
-        // Check if the name starts with the directory
-        if (line.name.find(corrected_dir) != 0) continue;
-        // Remove the directory from the name
-        std::string name = line.name.substr(corrected_dir.length());
-        // If there is a remaining slash and recursion is disabled, only keep the name of the directory
-        if (name.find("/") != std::string::npos && !recursive) name = name.substr(0, name.find("/") + 1);
-        // Add the name to the vector if it is not already present
-        if (std::find(files.begin(), files.end(), name) == files.end()) files.push_back(name);
+    const int32_t node = findDirectory(pathKey(dir));
+    if (node == -1) return files;
+    // list the whole subtree if recursion is enabled
+    if (recursive) {
+        listSubtree(node, "", files);
+        return files;
     }
+    // otherwise only list the files and the subdirectories, which end with a slash
+    for (const std::string& file : directories[node].files) files.push_back(file);
+    for (const auto& directory : directories[node].directories) files.push_back(directory.first + "/");
     return files;
 }
 
 /**
  * @brief Check if a file exists
  *
+ * Does not allocate any memory.
+ *
  * @param path path of the file
  * @return true the file exists
  * @return false the file does not exist
  */
-bool fileExists(const std::string& path) {
-    // if the path does not start with a slash, add one
-    const std::string corrected_path = (path.front() == '/') ? path : ('/' + path);
+bool fileExists(std::string_view path) {
+    const SnapshotReference snapshot;
     // return true if the file is found in the index, false otherwise
-    std::vector<lemlibFile> index = readFileIndex();
-    return std::any_of(index.begin(), index.end(), [&](const lemlibFile& file) { return file.name == corrected_path; });
+    return snapshot.findFile(path) != nullptr;
 }
 
 /**
@@ -158,21 +2383,19 @@ bool fileExists(const std::string& path) {
  *
  * @param path the path of the virtual file
  */
-void deleteFile(const std::string& path) {
-    // if the path does not start with a slash, add one
-    const std::string corrected_path = (path.front() == '/') ? path : ('/' + path);
-    if (!fileExists(corrected_path)) throw FILE_NOT_FOUND(corrected_path);
+void deleteFile(std::string_view path) {
+    IndexWriteLock indexLock;
+    if (!vfsInitialized) throw VFS_NOT_INITIALIZED;
+    const std::string corrected_path = normalizePath(path);
+    // the snapshot lags behind the changes made under the lock, so the resident index is checked directly
+    if (findFile(corrected_path) == nullptr) throw FILE_NOT_FOUND(corrected_path);
     // empty the sector the file is stored in
-    std::ofstream sector(getFileSector(corrected_path.c_str()));
-    sector << "";
-    // remove the file from the index file
-    auto index = readFileIndex();
-    index.erase(
-        std::remove_if(index.begin(), index.end(), [&](const lemlibFile& line) { return line.name == corrected_path; }),
-        index.end());
-    std::ofstream indexFile("/usd/index.txt");
-    if (!indexFile.is_open()) throw CANNOT_OPEN_FILE("/usd/index.txt");
-    for (const lemlibFile& line : index) { indexFile << line.name << "/" << line.sector << std::endl; }
+    const uint32_t sector = findFile(corrected_path)->sector;
+    if (!isContainerFile(sector) && !isInlineFile(sector)) std::ofstream(getSectorPath(sector)) << "";
+    // record the deletion in the journal and remove the file from the resident index
+    appendJournal(JOURNAL_DELETE, sector, corrected_path);
+    deadRecords += deleteEntry(corrected_path) + 2;
+    compactIfNeeded();
 }
 
 /**
@@ -181,31 +2404,202 @@ void deleteFile(const std::string& path) {
  * @param path the path of the virtual file
  * @return std::string the sector the file is stored in
  */
-std::string createFile(const std::string& path, bool overwrite = true) {
-    // if the path does not start with a slash, add one
-    const std::string corrected_path = (path.front() == '/') ? path : ('/' + path);
-    // Create the file in the index file
-    std::ofstream indexFile("/usd/index.txt", std::ios_base::app);
-    if (!indexFile.is_open()) throw CANNOT_OPEN_FILE("/usd/index.txt");
+std::string createFile(std::string_view path, bool overwrite) {
+    IndexWriteLock indexLock;
+    if (!vfsInitialized) throw VFS_NOT_INITIALIZED;
+    const std::string corrected_path = normalizePath(path);
+    checkPathLength(corrected_path);
     // Check if the file already exists
-    if (fileExists(corrected_path)) {
+    if (findFile(corrected_path) != nullptr) {
         if (overwrite) deleteFile(corrected_path);
         else throw FILE_ALREADY_EXISTS(corrected_path);
     }
     // Find the first empty sector
-    std::vector<lemlibFile> index = readFileIndex();
-    int sector = 0;
-    for (const lemlibFile& file : index) {
-        if (file.sector == std::to_string(sector)) sector++;
+    const uint32_t sector = findFreeSector();
+    // Create the file in the index
+    const uint8_t flags = newFileFlags();
+    appendJournal(JOURNAL_CREATE, sector, corrected_path, "", flags);
+    insertFile(corrected_path, sector, defaultCompression ? INDEX_COMPRESSED : 0);
+    if (flags & JOURNAL_CONTAINER) {
+        // container files get their blocks when they are written to
+        std::lock_guard<pros::Mutex> lock(containerMutex);
+        containerFiles[sector] = {0, {}, 0, 0};
+        return std::to_string(sector);
+    }
+    if (flags & JOURNAL_INLINE) {
+        // inline files get a sector file when they are promoted
+        std::lock_guard<pros::Mutex> lock(inlineMutex);
+        inlineFiles[sector] = {"", true, false};
+        return std::to_string(sector);
     }
-    // Create the file
-    indexFile << corrected_path << "/" << sector << std::endl;
-    indexFile.close();
     // create the sector file
-    std::ofstream sectorFile("/usd" + std::to_string(sector));
-    if (!sectorFile.is_open()) throw CANNOT_OPEN_FILE("/usd" + std::to_string(sector));
+    const std::string sectorPath = getSectorPath(sector);
+    std::ofstream sectorFile(sectorPath);
+    if (!sectorFile.is_open()) throw CANNOT_OPEN_FILE(sectorPath);
     sectorFile << "";
     sectorFile.close();
     // return the sector the file is stored in
     return std::to_string(sector);
 }
+
+/**
+ * @brief Rename a virtual file
+ *
+ * The contents of the file are not touched, only its entry in the index is changed.
+ *
+ * @param oldPath the current path of the virtual file
+ * @param newPath the new path of the virtual file
+ * @param overwrite whether to delete a file that already exists at the new path
+ */
+void renameFile(std::string_view oldPath, std::string_view newPath, bool overwrite) {
+    IndexWriteLock indexLock;
+    const std::string corrected_old = normalizePath(oldPath);
+    const std::string corrected_new = normalizePath(newPath);
+    if (!vfsInitialized) throw VFS_NOT_INITIALIZED;
+    if (findFile(corrected_old) == nullptr) throw FILE_NOT_FOUND(corrected_old);
+    if (corrected_old == corrected_new) return;
+    checkPathLength(corrected_new);
+    // Check if the new path is already taken
+    if (findFile(corrected_new) != nullptr) {
+        if (overwrite) deleteFile(corrected_new);
+        else throw FILE_ALREADY_EXISTS(corrected_new);
+    }
+    // record the rename in the journal and move the entry in the resident index
+    const uint32_t sector = findFile(corrected_old)->sector;
+    const uint16_t flags = findFile(corrected_old)->flags;
+    appendJournal(JOURNAL_RENAME, sector, corrected_old, corrected_new);
+    removeFile(corrected_old);
+    insertFile(corrected_new, sector, flags);
+    deadRecords++;
+    compactIfNeeded();
+}
+
+namespace lemlib {
+namespace fs {
+Transaction& Transaction::create(std::string_view path, bool overwrite) {
+    m_operations.push_back({Operation::CREATE, normalizePath(path), "", overwrite});
+    return *this;
+}
+
+Transaction& Transaction::remove(std::string_view path) {
+    m_operations.push_back({Operation::DELETE, normalizePath(path), "", false});
+    return *this;
+}
+
+Transaction& Transaction::rename(std::string_view oldPath, std::string_view newPath, bool overwrite) {
+    m_operations.push_back({Operation::RENAME, normalizePath(oldPath), normalizePath(newPath), overwrite});
+    return *this;
+}
+
+void Transaction::clear() { m_operations.clear(); }
+
+size_t Transaction::size() const { return m_operations.size(); }
+
+void Transaction::commit() {
+    IndexWriteLock indexLock;
+    if (!vfsInitialized) throw VFS_NOT_INITIALIZED;
+    // take the staged changes, so they are cleared even if the commit fails
+    const std::vector<Operation> operations = std::move(m_operations);
+    m_operations.clear();
+    if (operations.empty()) return;
+    // sectors of the files as they will be after the changes staged so far, or -1 for deleted files
+    std::map<std::string, int64_t, std::less<>> staged;
+    const auto sectorOf = [&](std::string_view path) -> int64_t {
+        const auto it = staged.find(path);
+        if (it != staged.end()) return it->second;
+        const lemlibFile* file = findFile(path);
+        return (file != nullptr) ? static_cast<int64_t>(file->sector) : -1;
+    };
+    // records of the batch, encoded once every change is checked
+    struct StagedRecord {
+            uint8_t type;
+            uint32_t sector;
+            std::string_view name;
+            std::string_view newName;
+            uint8_t flags;
+    };
+    std::vector<StagedRecord> records;
+    // sectors handed out to new files, which are given back if the commit fails
+    std::vector<uint32_t> allocated;
+    // sector files of deleted files, container files have none
+    std::vector<uint32_t> deleted;
+    // files created earlier in the batch are dropped from it instead of being deleted, so they never touch the SD card
+    const auto stageDelete = [&](int64_t sector, std::string_view path) {
+        const auto created = std::find(allocated.begin(), allocated.end(), sector);
+        if (created == allocated.end()) {
+            records.push_back({JOURNAL_DELETE, static_cast<uint32_t>(sector), path, "", 0});
+            if (!isContainerFile(sector) && !isInlineFile(sector)) deleted.push_back(sector);
+            return;
+        }
+        records.erase(std::remove_if(records.begin(), records.end(),
+                                     [&](const StagedRecord& record) {
+                                         return record.sector == sector &&
+                                                (record.type == JOURNAL_CREATE || record.type == JOURNAL_RENAME);
+                                     }),
+                      records.end());
+        markSectorFree(sector);
+        allocated.erase(created);
+    };
+    std::vector<char> buffer;
+    try {
+        for (const Operation& operation : operations) {
+            const int64_t sector = sectorOf(operation.path);
+            const std::string& target = (operation.type == Operation::RENAME) ? operation.newPath : operation.path;
+            if (operation.type != Operation::CREATE && sector == -1) throw FILE_NOT_FOUND(operation.path);
+            if (operation.type == Operation::RENAME && operation.path == operation.newPath) continue;
+            checkPathLength(target);
+            if (operation.type == Operation::DELETE) {
+                stageDelete(sector, operation.path);
+                staged[operation.path] = -1;
+                continue;
+            }
+            // creates and renames replace the file at their target if overwriting is allowed
+            const int64_t replaced = sectorOf(target);
+            if (replaced != -1) {
+                if (!operation.overwrite) throw FILE_ALREADY_EXISTS(target);
+                stageDelete(replaced, target);
+            }
+            if (operation.type == Operation::CREATE) {
+                const uint32_t newSector = findFreeSector();
+                markSectorUsed(newSector);
+                allocated.push_back(newSector);
+                records.push_back({JOURNAL_CREATE, newSector, operation.path, "", newFileFlags()});
+                staged[operation.path] = newSector;
+            } else {
+                const uint32_t renamed = static_cast<uint32_t>(sector);
+                records.push_back({JOURNAL_RENAME, renamed, operation.path, operation.newPath, 0});
+                staged[operation.path] = -1;
+                staged[operation.newPath] = sector;
+            }
+        }
+        // the changes may cancel out
+        if (records.empty()) {
+            for (const uint32_t sector : allocated) markSectorFree(sector);
+            return;
+        }
+        // write the whole batch with a single call
+        encodeJournalRecord(buffer, JOURNAL_BATCH, static_cast<uint32_t>(records.size()), "");
+        for (const StagedRecord& record : records)
+            encodeJournalRecord(buffer, record.type, record.sector, record.name, record.newName, record.flags);
+        writeJournal(buffer);
+    } catch (...) {
+        for (const uint32_t sector : allocated) markSectorFree(sector);
+        throw;
+    }
+    // apply the batch to the resident index the same way it would be replayed
+    for (const uint32_t sector : allocated) markSectorFree(sector);
+    size_t offset = sizeof(lemlibJournalRecord);
+    while (offset < buffer.size()) {
+        lemlibJournalRecord record;
+        const size_t recordSize = readJournalRecord(buffer, offset, record);
+        replayJournalRecord(buffer, offset, record);
+        offset += recordSize;
+    }
+    totalRecords++;
+    deadRecords++;
+    // empty the sectors of the deleted files, so they are empty when they are reused
+    for (const uint32_t sector : deleted) std::ofstream(getSectorPath(sector)) << "";
+    compactIfNeeded();
+}
+} // namespace fs
+} // namespace lemlib
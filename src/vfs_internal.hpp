@@ -0,0 +1,549 @@
+#pragma once
+
+#include "pros/apix.h"
+#include "pros/rtos.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Exception codes
+#define VFS_NOT_INITIALIZED VFSException("VFS_NOT_INITIALIZED")
+#define VFS_INIT_FAILED VFSException("VFS_INIT_FAILED")
+#define FILE_NOT_FOUND(filename) (VFSException(std::string("FILE_NOT_FOUND (") + filename + ")"))
+#define FILE_ALREADY_EXISTS(filename) (VFSException(std::string("FILE_ALREADY_EXISTS (") + filename + ")"))
+#define CANNOT_OPEN_FILE(filename) (VFSException(std::string("CANNOT_OPEN_FILE (") + filename + ")"))
+#define INDEX_CORRUPTED(filename) (VFSException(std::string("INDEX_CORRUPTED (") + filename + ")"))
+#define FILE_NOT_OPEN VFSException("FILE_NOT_OPEN")
+#define CANNOT_READ_FILE(filename) (VFSException(std::string("CANNOT_READ_FILE (") + filename + ")"))
+#define CANNOT_WRITE_FILE(filename) (VFSException(std::string("CANNOT_WRITE_FILE (") + filename + ")"))
+#define FILE_TOO_LARGE(filename) (VFSException(std::string("FILE_TOO_LARGE (") + filename + ")"))
+#define PATH_TOO_LONG(filename) (VFSException(std::string("PATH_TOO_LONG (") + filename + ")"))
+
+/**
+ * @brief Internals of the VFS shared between its source files
+ *
+ * Not part of the public API, use include/lemlib/vfs.hpp instead.
+ */
+
+/**
+ * @brief Normalize a path so it starts with a slash
+ *
+ * @param path the path
+ * @return std::string the normalized path
+ */
+std::string normalizePath(std::string_view path);
+
+/**
+ * @brief Get the part of a path after the leading slash
+ *
+ * @param path the path, with or without a leading slash
+ * @return std::string_view the path without the leading slash
+ */
+std::string_view pathKey(std::string_view path);
+
+/**
+ * @brief Get the path of the real file a sector is stored in
+ *
+ * @param sector the sector
+ * @return std::string the path of the sector file
+ */
+std::string getSectorPath(uint32_t sector);
+
+/**
+ * @brief Look up the sector of a virtual file without allocating
+ *
+ * @param path the path of the virtual file
+ * @param sector set to the sector the file is stored in if it is found
+ * @return true the file was found
+ * @return false the file does not exist
+ */
+bool lookupFileSector(std::string_view path, uint32_t& sector);
+
+/**
+ * @brief Look up the sector of a virtual file, creating the file if it does not exist
+ *
+ * @param path the path of the virtual file
+ * @return uint32_t the sector the file is stored in
+ */
+uint32_t findOrCreateFile(std::string_view path);
+
+/**
+ * @brief Check if a virtual file is compressed
+ *
+ * @param path the path of the virtual file
+ * @return true the file is compressed
+ * @return false the file is not compressed or does not exist
+ */
+bool isCompressedFile(std::string_view path);
+
+/**
+ * @brief Compute the CRC-32 of a block of memory
+ *
+ * @param data the data to checksum
+ * @param size the number of bytes
+ * @param crc the checksum of the preceding data, to checksum several blocks as one
+ * @return uint32_t the checksum
+ */
+uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
+
+/**
+ * @brief Check if a file is stored in the containers
+ *
+ * @param sector the sector of the file
+ * @return true the file is a container file
+ * @return false the file is a sector file or does not exist
+ */
+bool isContainerFile(uint32_t sector);
+
+/**
+ * @brief Get the length of a container file
+ *
+ * @param sector the sector of the file
+ * @param length set to the length of the file in bytes if it is a container file
+ * @return true the file is a container file
+ * @return false the file is a sector file or does not exist
+ */
+bool getContainerLength(uint32_t sector, size_t& length);
+
+/**
+ * @brief Read from a container file
+ *
+ * @param sector the sector of the file
+ * @param offset where to start reading
+ * @param data where to store the bytes read
+ * @param size the number of bytes to read
+ * @return size_t the number of bytes read, 0 at the end of the file or if the containers could not be read
+ */
+size_t readContainer(uint32_t sector, size_t offset, void* data, size_t size);
+
+/**
+ * @brief Write to a container file, allocating blocks as needed
+ *
+ * The new blocks and length are only recorded in the journal by commitContainer().
+ *
+ * @param sector the sector of the file
+ * @param offset where to start writing
+ * @param data the bytes to write
+ * @param size the number of bytes to write
+ * @return true the bytes were written
+ * @return false the file does not exist or the containers could not be written
+ */
+bool writeContainer(uint32_t sector, size_t offset, const void* data, size_t size);
+
+/**
+ * @brief Empty a container file, keeping its blocks for the data written next
+ *
+ * @param sector the sector of the file
+ */
+void truncateContainer(uint32_t sector);
+
+/**
+ * @brief Record the blocks and the length of a container file in the journal
+ *
+ * @param sector the sector of the file
+ */
+void commitContainer(uint32_t sector);
+
+/**
+ * @brief Check if a file is stored in the index
+ *
+ * @param sector the sector of the file
+ * @return true the file is an inline file
+ * @return false the file is stored elsewhere or does not exist
+ */
+bool isInlineFile(uint32_t sector);
+
+/**
+ * @brief Get the length of an inline file
+ *
+ * @param sector the sector of the file
+ * @param length set to the length of the file in bytes if it is an inline file
+ * @return true the file is an inline file
+ * @return false the file is stored elsewhere or does not exist
+ */
+bool getInlineLength(uint32_t sector, size_t& length);
+
+/**
+ * @brief Read from an inline file
+ *
+ * @param sector the sector of the file
+ * @param offset where to start reading
+ * @param data where to store the bytes read
+ * @param size the number of bytes to read
+ * @return size_t the number of bytes read, 0 at the end of the file
+ */
+size_t readInline(uint32_t sector, size_t offset, void* data, size_t size);
+
+/**
+ * @brief Write to an inline file
+ *
+ * The contents are only recorded in the journal by commitInline().
+ *
+ * @param sector the sector of the file
+ * @param offset where to start writing
+ * @param data the bytes to write
+ * @param size the number of bytes to write
+ * @return true the bytes were written
+ * @return false the file is not an inline file
+ */
+bool writeInline(uint32_t sector, size_t offset, const void* data, size_t size);
+
+/**
+ * @brief Empty an inline file
+ *
+ * @param sector the sector of the file
+ */
+void truncateInline(uint32_t sector);
+
+/**
+ * @brief Record the contents of an inline file in the journal
+ *
+ * @param sector the sector of the file
+ */
+void commitInline(uint32_t sector);
+
+/**
+ * @brief Turn an inline file into a sector file holding the same contents
+ *
+ * @param sector the sector of the file
+ */
+void promoteInlineFile(uint32_t sector);
+
+/**
+ * @brief Get the length of a reserved sector file
+ *
+ * @param sector the sector of the file
+ * @param length set to the length of the data in bytes if the file has space reserved
+ * @return true the file has space reserved
+ * @return false the file has no space reserved or does not exist
+ */
+bool getReservedLength(uint32_t sector, size_t& length);
+
+/**
+ * @brief Extend the length of a reserved sector file after a write
+ *
+ * The new length is only recorded in the journal by commitReserved().
+ *
+ * @param sector the sector of the file
+ * @param end the end of the write
+ */
+void extendReserved(uint32_t sector, size_t end);
+
+/**
+ * @brief Empty a reserved sector file, keeping its space for the data written next
+ *
+ * @param sector the sector of the file
+ */
+void truncateReserved(uint32_t sector);
+
+/**
+ * @brief Record the length of a reserved sector file in the journal
+ *
+ * @param sector the sector of the file
+ */
+void commitReserved(uint32_t sector);
+
+/**
+ * @brief Compact the index journal queued by queueCompaction(), if it still needs to be
+ *
+ * Runs on the VFS I/O task.
+ */
+void compactQueuedIndex();
+
+namespace lemlib {
+namespace fs {
+/**
+ * @brief Reader-writer lock built on pros::Mutex
+ *
+ * Any number of tasks can hold it shared, or a single task exclusively. Readers only count themselves in while no
+ * writer holds it, so lookups never block each other. A writer takes the turnstile, which makes new readers wait on it,
+ * then sleeps until the last reader inside leaves and wakes it, so writers are not starved by a steady stream of
+ * readers. The task holding it exclusively can take it again, shared or exclusively, so functions that lock it can call
+ * each other. A task holding it shared must not take it exclusively.
+ */
+class SharedMutex {
+    public:
+        SharedMutex();
+        ~SharedMutex();
+
+        SharedMutex(const SharedMutex&) = delete;
+        SharedMutex& operator=(const SharedMutex&) = delete;
+
+        /**
+         * @brief Take the lock exclusively, waiting for the readers holding it to leave
+         *
+         */
+        void lock();
+
+        /**
+         * @brief Give back the exclusive lock
+         *
+         */
+        void unlock();
+
+        /**
+         * @brief Take the lock shared, waiting for a writer holding or waiting for it
+         *
+         */
+        void lock_shared();
+
+        /**
+         * @brief Give back the shared lock
+         *
+         */
+        void unlock_shared();
+    private:
+        /**
+         * @brief Count a reader out, waking the writer if it was the last one
+         *
+         */
+        void leave();
+
+        // held by the writer for as long as it holds the lock, readers wait on it while a writer is inside
+        pros::Mutex m_turnstile;
+        // given by the last reader to leave while a writer holds the turnstile
+        pros::c::sem_t m_drained;
+        std::atomic<size_t> m_readers = 0;
+        std::atomic<pros::task_t> m_owner = nullptr;
+        size_t m_depth = 0;
+};
+
+/**
+ * @brief Holds a SharedMutex shared for as long as it exists
+ *
+ */
+class SharedLock {
+    public:
+        explicit SharedLock(SharedMutex& mutex)
+            : m_mutex(mutex) {
+            m_mutex.lock_shared();
+        }
+
+        ~SharedLock() { m_mutex.unlock_shared(); }
+
+        SharedLock(const SharedLock&) = delete;
+        SharedLock& operator=(const SharedLock&) = delete;
+    private:
+        SharedMutex& m_mutex;
+};
+
+// the unit of caching and read-ahead
+constexpr size_t CACHE_BLOCK_SIZE = 512;
+// the largest amount of data compressed as a single frame, which is also the buffer size of compressed files
+constexpr size_t COMPRESSED_FRAME_SIZE = 4096;
+
+/**
+ * @brief Compress a frame of a compressed file in the LZ4 block format
+ *
+ * The working memory is a small hash table on the stack, so nothing is allocated.
+ *
+ * @param data the data to compress
+ * @param size the size of the data, at most COMPRESSED_FRAME_SIZE
+ * @param out where to store the compressed data, at least size bytes
+ * @return size_t the size of the compressed data, or 0 if it would not be smaller than the data
+ */
+size_t compressFrame(const char* data, size_t size, char* out);
+
+/**
+ * @brief Decompress a frame compressed by compressFrame()
+ *
+ * Corrupted data is detected without reading or writing out of bounds.
+ *
+ * @param data the compressed data
+ * @param size the size of the compressed data
+ * @param out where to store the decompressed data
+ * @param rawSize the size of the decompressed data
+ * @return true the frame was decompressed
+ * @return false the compressed data is corrupted
+ */
+bool decompressFrame(const char* data, size_t size, char* out, size_t rawSize);
+
+/**
+ * @brief Where the data of an open virtual file is stored
+ *
+ * Sector files are accessed through the stream of the handle, container files through the shared containers and
+ * inline files through the resident index. The length of a reserved sector file is tracked in the resident index,
+ * since its sector file is larger than its data. The stream is only used with its lock held.
+ */
+struct FileStorage {
+        std::fstream* stream;
+        pros::Mutex* streamMutex;
+        uint32_t sector;
+        bool container;
+        bool inlined;
+        bool reserved;
+};
+
+/**
+ * @brief Read from the storage of a file through the block cache
+ *
+ * @param storage the storage of the file
+ * @param offset where to start reading
+ * @param data where to store the bytes read
+ * @param size the number of bytes to read
+ * @return size_t the number of bytes read, 0 at the end of the file or if it could not be read
+ */
+size_t readStorage(const FileStorage& storage, size_t offset, char* data, size_t size);
+
+/**
+ * @brief Write to the storage of a file, updating the blocks of it in the cache
+ *
+ * @param storage the storage of the file
+ * @param offset where to start writing
+ * @param data the bytes to write
+ * @param size the number of bytes to write
+ * @return true the bytes were written
+ * @return false the file could not be written
+ */
+bool writeStorage(const FileStorage& storage, size_t offset, const char* data, size_t size);
+
+/**
+ * @brief Read from the storage of a file, bypassing the cache
+ *
+ * @param storage the storage of the file
+ * @param offset where to start reading
+ * @param data where to store the bytes read
+ * @param size the number of bytes to read
+ * @return size_t the number of bytes read, 0 at the end of the file or if it could not be read
+ */
+size_t readUncached(const FileStorage& storage, size_t offset, char* data, size_t size);
+
+/**
+ * @brief Write to the storage of a file, bypassing the cache
+ *
+ * @param storage the storage of the file
+ * @param offset where to start writing
+ * @param data the bytes to write
+ * @param size the number of bytes to write
+ * @return true the bytes were written
+ * @return false the file could not be written
+ */
+bool writeUncached(const FileStorage& storage, size_t offset, const char* data, size_t size);
+
+/**
+ * @brief Set the size of the block cache, dropping every cached block
+ *
+ * @param bytes the RAM budget of the cache, 0 to disable it
+ */
+void configureCache(size_t bytes);
+
+/**
+ * @brief Drop every cached block
+ *
+ */
+void clearCache();
+
+/**
+ * @brief Drop the cached blocks of a file, when it is emptied or its sector is freed
+ *
+ * @param sector the sector of the file
+ */
+void invalidateCache(uint32_t sector);
+
+/**
+ * @brief Read from the storage of a file through the cache
+ *
+ * Cached blocks are copied from RAM. Missing blocks are read from the SD card and cached, runs of whole missing blocks
+ * with a single read.
+ *
+ * @param storage the storage of the file
+ * @param offset where to start reading
+ * @param data where to store the bytes read
+ * @param size the number of bytes to read
+ * @return size_t the number of bytes read
+ */
+size_t readCached(const FileStorage& storage, size_t offset, char* data, size_t size);
+
+/**
+ * @brief Read blocks of a file that are not cached yet into the cache
+ *
+ * Used by the read-ahead task. The SD card is read without holding the cache, and prefetched blocks are the first to be
+ * evicted until they are read.
+ *
+ * @param storage the storage of the file
+ * @param offset the start of the range to prefetch
+ * @param size the size of the range to prefetch
+ * @param staging the buffer to read the blocks into before they are cached
+ */
+void prefetchBlocks(const FileStorage& storage, size_t offset, size_t size, std::vector<char>& staging);
+
+/**
+ * @brief Queue a range of a file to be prefetched into the cache by the read-ahead task
+ *
+ * Starts the task if needed. A new request replaces the queued request of the same handle, and requests are dropped if
+ * too many handles are waiting.
+ *
+ * @param storage the storage of the file
+ * @param offset the start of the range
+ * @param size the size of the range
+ */
+void requestReadAhead(const FileStorage& storage, size_t offset, size_t size);
+
+/**
+ * @brief Drop the queued read-ahead of a handle and wait until the task is done with it
+ *
+ * Must be called before the stream of the handle is closed, moved or used outside of readUncached() and
+ * writeUncached().
+ *
+ * @param stream the stream of the handle
+ */
+void cancelReadAhead(const std::fstream* stream);
+
+/**
+ * @brief Update the cached blocks of a file after a write
+ *
+ * Blocks that are not cached are not added, the cache only allocates slots on reads.
+ *
+ * @param sector the sector of the file
+ * @param offset where the data was written
+ * @param data the bytes written
+ * @param size the number of bytes written
+ */
+void updateCache(uint32_t sector, size_t offset, const char* data, size_t size);
+
+/**
+ * @brief The state a file handle shares with the write-behind flush task
+ *
+ * pending and failed are guarded by the lock of the write-behind queue. The flush task only uses the storage while
+ * pending is not 0, and the handle only uses it while pending is 0.
+ */
+struct WriteBehindTarget {
+        FileStorage storage;
+        // bytes queued for this handle that have not been written or discarded yet
+        size_t pending = 0;
+        // set when a queued write fails
+        bool failed = false;
+};
+
+/**
+ * @brief Copy data to the write-behind queue
+ *
+ * Starts the flush task if needed, and applies the overflow policy if the queue is full.
+ *
+ * @param target the handle the data belongs to
+ * @param offset where to write the data in the sector file
+ * @param data the bytes to write
+ * @param size the number of bytes to write
+ */
+void queueWrite(WriteBehindTarget& target, size_t offset, const char* data, size_t size);
+
+/**
+ * @brief Wait until the write-behind queue holds no data of a handle
+ *
+ * @param target the handle
+ * @return true all the queued writes of the handle succeeded since the last call
+ * @return false a queued write failed
+ */
+bool waitForWrites(WriteBehindTarget& target);
+
+/**
+ * @brief Queue a compaction of the index journal to the VFS I/O task, without waiting for it
+ *
+ */
+void queueCompaction();
+} // namespace fs
+} // namespace lemlib
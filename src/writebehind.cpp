@@ -0,0 +1,225 @@
+/*----------------------------------------------------------------------------*/
+/*                                                                            */
+/*    Module:       writebehind.cpp                                           */
+/*    Author:       LemLib Team                                               */
+/*    Description:  Queue of writes drained to the SD card by a task          */
+/*                                                                            */
+/*----------------------------------------------------------------------------*/
+#include "lemlib/vfs.hpp"
+#include "vfs_internal.hpp"
+#include "pros/rtos.hpp"
+#include <algorithm>
+#include <optional>
+#include <string.h>
+
+namespace lemlib {
+namespace fs {
+// a queued write is a header followed by its data, stored in a ring buffer that may split them at its end
+struct ChunkHeader {
+        WriteBehindTarget* target;
+        uint32_t offset;
+        uint32_t length;
+};
+
+// the queue is never shrunk below this, so every write can be split into a few chunks
+static constexpr size_t MIN_CAPACITY = 256;
+
+static pros::Mutex queueMutex;
+static std::optional<pros::Task> flushTask;
+static WriteBehindConfig queueConfig;
+static std::vector<char> ring;
+static size_t ringHead = 0;
+static size_t ringUsed = 0;
+static size_t queuedBytes = 0;
+static size_t droppedBytes = 0;
+// set while the flush task writes a chunk it took out of the queue
+static bool flushing = false;
+// posted once for each task waiting for the queue to change when a chunk leaves it
+static pros::c::sem_t chunkDone = pros::c::sem_create(UINT32_MAX, 0);
+static size_t waiters = 0;
+
+/**
+ * @brief Wait until a chunk leaves the queue, because it was written or dropped
+ *
+ * Must be called with the queue locked, and returns with it locked.
+ */
+static void waitForChunk() {
+    waiters++;
+    queueMutex.give();
+    pros::c::sem_wait(chunkDone, TIMEOUT_MAX);
+    queueMutex.take();
+}
+
+/**
+ * @brief Wake the tasks waiting for a chunk to leave the queue
+ *
+ * Must be called with the queue locked.
+ */
+static void wakeWaiters() {
+    for (; waiters > 0; waiters--) pros::c::sem_post(chunkDone);
+}
+
+/**
+ * @brief Get the largest amount of data a single chunk may hold
+ *
+ * Chunks are limited to a quarter of the queue, so a full queue frees room for a new chunk quickly.
+ */
+static size_t maxChunkData() { return ring.size() / 4 - sizeof(ChunkHeader); }
+
+/**
+ * @brief Copy bytes to the end of the queue
+ *
+ */
+static void ringPush(const void* data, size_t size) {
+    const char* in = static_cast<const char*>(data);
+    const size_t tail = (ringHead + ringUsed) % ring.size();
+    const size_t n = std::min(size, ring.size() - tail);
+    memcpy(ring.data() + tail, in, n);
+    memcpy(ring.data(), in + n, size - n);
+    ringUsed += size;
+}
+
+/**
+ * @brief Take bytes from the front of the queue
+ *
+ * @param data where to copy the bytes, or nullptr to discard them
+ */
+static void ringPop(void* data, size_t size) {
+    if (data != nullptr) {
+        char* out = static_cast<char*>(data);
+        const size_t n = std::min(size, ring.size() - ringHead);
+        memcpy(out, ring.data() + ringHead, n);
+        memcpy(out + n, ring.data(), size - n);
+    }
+    ringHead = (ringHead + size) % ring.size();
+    ringUsed -= size;
+}
+
+/**
+ * @brief Discard the oldest chunk in the queue
+ *
+ * Must be called with the queue locked.
+ */
+static void dropOldestChunk() {
+    ChunkHeader header;
+    ringPop(&header, sizeof(header));
+    ringPop(nullptr, header.length);
+    header.target->pending -= header.length;
+    queuedBytes -= header.length;
+    droppedBytes += header.length;
+    wakeWaiters();
+}
+
+/**
+ * @brief Write the queue to the SD card, one chunk at a time
+ *
+ */
+static void flushLoop() {
+    std::vector<char> data;
+    while (true) {
+        queueMutex.take();
+        if (ringUsed == 0) {
+            queueMutex.give();
+            pros::Task::notify_take(true, TIMEOUT_MAX);
+            continue;
+        }
+        // copy the chunk out so the queue can be written to while the SD card is busy
+        ChunkHeader header;
+        ringPop(&header, sizeof(header));
+        data.resize(header.length);
+        ringPop(data.data(), header.length);
+        flushing = true;
+        queueMutex.give();
+
+        const bool written = writeStorage(header.target->storage, header.offset, data.data(), header.length);
+
+        queueMutex.take();
+        if (!written) header.target->failed = true;
+        header.target->pending -= header.length;
+        queuedBytes -= header.length;
+        flushing = false;
+        wakeWaiters();
+        queueMutex.give();
+    }
+}
+
+/**
+ * @brief Wait until the queue is empty and the flush task is idle
+ *
+ * Returns with the queue locked.
+ */
+static void waitForEmptyQueue() {
+    queueMutex.take();
+    while (ringUsed != 0 || flushing) waitForChunk();
+}
+
+void configureWriteBehind(const WriteBehindConfig& config) {
+    waitForEmptyQueue();
+    queueConfig = config;
+    ring.resize(std::max(config.capacity, MIN_CAPACITY));
+    ring.shrink_to_fit();
+    ringHead = 0;
+    if (!flushTask) flushTask.emplace(flushLoop, config.priority, TASK_STACK_DEPTH_DEFAULT, "VFS write-behind");
+    else flushTask->set_priority(config.priority);
+    queueMutex.give();
+}
+
+void flushWriteBehind() {
+    if (!flushTask) return;
+    waitForEmptyQueue();
+    queueMutex.give();
+}
+
+WriteBehindStats getWriteBehindStats() {
+    queueMutex.take();
+    const WriteBehindStats stats = {queuedBytes, droppedBytes};
+    queueMutex.give();
+    return stats;
+}
+
+void queueWrite(WriteBehindTarget& target, size_t offset, const char* data, size_t size) {
+    if (!flushTask) configureWriteBehind();
+    while (size > 0) {
+        queueMutex.take();
+        size_t n = std::min(size, maxChunkData());
+        bool dropped = false;
+        while (ring.size() - ringUsed < sizeof(ChunkHeader) + n) {
+            if (queueConfig.overflow == Overflow::DROP) {
+                dropped = true;
+                break;
+            }
+            if (queueConfig.overflow == Overflow::OVERWRITE_OLDEST) {
+                dropOldestChunk();
+            } else {
+                // BLOCK, the flush task frees a chunk per write it completes
+                waitForChunk();
+                n = std::min(size, maxChunkData());
+            }
+        }
+        if (dropped) {
+            droppedBytes += n;
+        } else {
+            const ChunkHeader header = {&target, static_cast<uint32_t>(offset), static_cast<uint32_t>(n)};
+            ringPush(&header, sizeof(header));
+            ringPush(data, n);
+            target.pending += n;
+            queuedBytes += n;
+        }
+        queueMutex.give();
+        if (!dropped) flushTask->notify();
+        offset += n;
+        data += n;
+        size -= n;
+    }
+}
+
+bool waitForWrites(WriteBehindTarget& target) {
+    queueMutex.take();
+    while (target.pending != 0) waitForChunk();
+    const bool succeeded = !target.failed;
+    target.failed = false;
+    queueMutex.give();
+    return succeeded;
+}
+} // namespace fs
+} // namespace lemlib